@@ -0,0 +1,694 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "utilities.h"
+#include "vm.h"
+
+// A cached bytecode file holds, in the host's byte order:
+//
+// - A header: BYTECODE_MAGIC, BYTECODE_FORMAT, the fingerprint of the VM that
+//   wrote it and the hash of the source it was compiled from.
+//
+// - The name of every global slot the VM had when the file was written. The
+//   compiler bakes slot numbers into instructions, so they are mapped to this
+//   VM's slots for the same names when the file is loaded.
+//
+// - The script's function. A function is its arity, upvalue count and name,
+//   followed by its chunk: the code, the line table as runs of equal lines,
+//   the number of inline caches and the constants. Function constants are
+//   written out in full where they appear, so nested functions follow their
+//   enclosing one. Upvalue descriptors are operands of OP_CLOSURE and
+//   OP_CLOSURE_LONG, so they come along with the code.
+//
+// Changing how anything above is laid out, or what an instruction's operands
+// mean, must bump BYTECODE_FORMAT. Adding, removing or reordering opcodes is
+// caught by the fingerprint.
+
+#define BYTECODE_MAGIC 0x43534847 // "GHSC" when little endian.
+#define BYTECODE_FORMAT 3
+
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantTag;
+
+static const char* opcodeNames[] = {
+    #define OPCODE(name) #name,
+    #include "opcodes.h"
+    #undef OPCODE
+};
+
+#define OPCODE_COUNT (int)(sizeof(opcodeNames) / sizeof(opcodeNames[0]))
+
+// 64-bit FNV-1a.
+static uint64_t hashBytes(uint64_t hash, const void* bytes, size_t length) {
+    const uint8_t* data = (const uint8_t*)bytes;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+// Identifies the VM that can run a bytecode file: its version, its
+// instruction set, how it represents values and the build options that
+// change the code the compiler emits.
+static uint64_t vmFingerprint(void) {
+    uint64_t hash = hashBytes(HASH_SEED, GHOST_VERSION, strlen(GHOST_VERSION));
+
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        hash = hashBytes(hash, opcodeNames[i], strlen(opcodeNames[i]) + 1);
+    }
+
+    uint32_t valueSize = sizeof(Value);
+    hash = hashBytes(hash, &valueSize, sizeof(valueSize));
+
+    uint8_t options[] = { OPTIMIZE_BYTECODE, NAN_BOXING };
+    return hashBytes(hash, options, sizeof(options));
+}
+
+// Writing ---------------------------------------------------------------------
+
+static void writeBytes(FILE* file, const void* bytes, size_t length) {
+    fwrite(bytes, 1, length, file);
+}
+
+static void writeU32(FILE* file, uint32_t value) {
+    writeBytes(file, &value, sizeof(value));
+}
+
+static void writeString(FILE* file, ObjString* string) {
+    writeU32(file, string->length);
+    writeBytes(file, string->chars, string->length);
+}
+
+static void writeFunction(FILE* file, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+
+    writeU32(file, function->arity);
+    writeU32(file, function->upvalueCount);
+
+    uint8_t hasName = function->name != NULL;
+    writeBytes(file, &hasName, 1);
+    if (hasName) writeString(file, function->name);
+
+    writeU32(file, chunk->count);
+    writeBytes(file, chunk->code, chunk->count);
+
+    uint32_t runs = 0;
+    for (int i = 0; i < chunk->count; i++) {
+        if (i == 0 || chunk->lines[i] != chunk->lines[i - 1]) runs++;
+    }
+
+    writeU32(file, runs);
+
+    for (int start = 0; start < chunk->count;) {
+        int end = start;
+        while (end < chunk->count && chunk->lines[end] == chunk->lines[start]) end++;
+
+        writeU32(file, chunk->lines[start]);
+        writeU32(file, end - start);
+        start = end;
+    }
+
+    writeU32(file, chunk->cacheCount);
+    writeU32(file, chunk->constants.count);
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        uint8_t tag;
+
+        if (IS_NUMBER(constant)) {
+            tag = CONSTANT_NUMBER;
+            writeBytes(file, &tag, 1);
+
+            double number = AS_NUMBER(constant);
+            writeBytes(file, &number, sizeof(number));
+        } else if (IS_STRING(constant)) {
+            tag = CONSTANT_STRING;
+            writeBytes(file, &tag, 1);
+            writeString(file, AS_STRING(constant));
+        } else {
+            tag = CONSTANT_FUNCTION;
+            writeBytes(file, &tag, 1);
+            writeFunction(file, AS_FUNCTION(constant));
+        }
+    }
+}
+
+// Writes [function] to [path], compiled from a source whose hash is
+// [sourceHash]. The file is written under a temporary name and then renamed,
+// so a concurrent run never loads half of it. Failing is harmless: the
+// source is simply compiled again next time.
+static void writeBytecode(GhostVM *vm, ObjFunction* function, const char* path, uint64_t sourceHash) {
+    size_t length = strlen(path) + 32;
+    char* temporary = malloc(length);
+    if (temporary == NULL) return;
+
+    snprintf(temporary, length, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE* file = fopen(temporary, "wb");
+
+    if (file == NULL) {
+        free(temporary);
+        return;
+    }
+
+    uint64_t fingerprint = vmFingerprint();
+
+    writeU32(file, BYTECODE_MAGIC);
+    writeU32(file, BYTECODE_FORMAT);
+    writeBytes(file, &fingerprint, sizeof(fingerprint));
+    writeBytes(file, &sourceHash, sizeof(sourceHash));
+
+    // Slot numbers are assigned in order, so the table's entries can be
+    // placed straight into their slots.
+    int globalCount = vm->globalValues.count;
+    ObjString** names = calloc(globalCount + 1, sizeof(ObjString*));
+
+    if (names == NULL) {
+        fclose(file);
+        remove(temporary);
+        free(temporary);
+        return;
+    }
+
+    for (int i = 0; i <= vm->globalSlots.capacity; i++) {
+        Entry* entry = &vm->globalSlots.entries[i];
+        if (entry->key != NULL) names[(int)AS_NUMBER(entry->value)] = entry->key;
+    }
+
+    writeU32(file, globalCount);
+
+    for (int i = 0; i < globalCount; i++) {
+        writeString(file, names[i]);
+    }
+
+    free(names);
+
+    writeFunction(file, function);
+
+    bool failed = ferror(file) != 0;
+    if (fclose(file) != 0) failed = true;
+
+    if (failed || rename(temporary, path) != 0) remove(temporary);
+
+    free(temporary);
+}
+
+// Reading ---------------------------------------------------------------------
+
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+
+    // Set once anything is out of bounds or malformed. Reads after that
+    // return zeroes, so callers only need to check it at the end.
+    bool failed;
+
+    // The slot in this VM for each global slot in the file.
+    int globalCount;
+    int* globalSlots;
+
+    // Whether any of [globalSlots] differs from the slot in the file.
+    bool relocate;
+} Reader;
+
+static void readBytes(Reader* reader, void* bytes, size_t length) {
+    if (reader->failed || reader->length - reader->position < length) {
+        reader->failed = true;
+        memset(bytes, 0, length);
+        return;
+    }
+
+    memcpy(bytes, reader->data + reader->position, length);
+    reader->position += length;
+}
+
+static uint32_t readU32(Reader* reader) {
+    uint32_t value;
+    readBytes(reader, &value, sizeof(value));
+    return value;
+}
+
+// Reads [length] bytes in place, returning NULL if there are not that many.
+static const char* readSpan(Reader* reader, uint32_t length) {
+    if (reader->failed || reader->length - reader->position < length) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const char* span = (const char*)reader->data + reader->position;
+    reader->position += length;
+    return span;
+}
+
+static ObjString* readString(GhostVM *vm, Reader* reader) {
+    uint32_t length = readU32(reader);
+    const char* chars = readSpan(reader, length);
+
+    if (chars == NULL) return NULL;
+
+    return copyString(vm, chars, length);
+}
+
+static int readU16Operand(uint8_t* operand) {
+    return (operand[0] << 8) | operand[1];
+}
+
+static int readU24Operand(uint8_t* operand) {
+    return (operand[0] << 16) | (operand[1] << 8) | operand[2];
+}
+
+// Whether [chunk] has a constant at [index] of the kind [tag] names, or of any
+// kind when [tag] is -1.
+static bool hasConstant(Chunk* chunk, int index, int tag) {
+    if (index < 0 || index >= chunk->constants.count) return false;
+
+    Value value = chunk->constants.values[index];
+
+    switch (tag) {
+        case CONSTANT_NUMBER: return IS_NUMBER(value);
+        case CONSTANT_STRING: return IS_STRING(value);
+        case CONSTANT_FUNCTION: return IS_FUNCTION(value);
+        default: return true;
+    }
+}
+
+// Whether the instruction at [offset] in [chunk] is a jump, storing where it
+// goes in [target] if so.
+static bool jumpTarget(Chunk* chunk, int offset, int* target) {
+    uint8_t* code = &chunk->code[offset];
+    int next = offset + instructionLength(chunk, offset);
+
+    switch (code[0]) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            *target = next + readU16Operand(code + 1);
+            return true;
+        case OP_LOOP:
+            *target = next - readU16Operand(code + 1);
+            return true;
+        case OP_LESS_LOCAL_CONST_JUMP:
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            *target = next + readU16Operand(code + 3);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Checks that the instruction at [offset] in [function]'s chunk exists, fits
+// in the chunk and only names constants of the right kind, inline caches,
+// upvalues and global slots that exist, mapping the global slot to this VM's
+// numbering. Returns the instruction's length, or 0 if it is malformed.
+static int checkInstruction(Reader* reader, ObjFunction* function, int offset) {
+    Chunk* chunk = &function->chunk;
+    uint8_t* code = &chunk->code[offset];
+
+    if (code[0] >= OPCODE_COUNT) return 0;
+
+    // A closure's length depends on the function it creates, so that is
+    // checked before the length is needed.
+    if (code[0] == OP_CLOSURE || code[0] == OP_CLOSURE_LONG) {
+        int width = code[0] == OP_CLOSURE ? 1 : 3;
+        if (offset + width >= chunk->count) return 0;
+
+        int constant = code[0] == OP_CLOSURE ? code[1] : readU24Operand(code + 1);
+        if (!hasConstant(chunk, constant, CONSTANT_FUNCTION)) return 0;
+    }
+
+    int length = instructionLength(chunk, offset);
+    if (length > chunk->count - offset) return 0;
+
+    // The upvalues a closure captures from this function's own.
+    if (code[0] == OP_CLOSURE || code[0] == OP_CLOSURE_LONG) {
+        for (int i = code[0] == OP_CLOSURE ? 2 : 4; i < length; i += 3) {
+            if (!code[i] && readU16Operand(code + i + 1) >= function->upvalueCount) return 0;
+        }
+    }
+
+    int constant = -1;
+    int tag = -1;
+    int cache = -1;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            constant = code[1];
+            break;
+
+        case OP_CONSTANT_LONG:
+            constant = readU24Operand(code + 1);
+            break;
+
+        case OP_GET_SUPER:
+        case OP_SUPER_INVOKE:
+        case OP_CLASS:
+        case OP_METHOD:
+            constant = code[1];
+            tag = CONSTANT_STRING;
+            break;
+
+        case OP_GET_SUPER_LONG:
+        case OP_SUPER_INVOKE_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+            constant = readU24Operand(code + 1);
+            tag = CONSTANT_STRING;
+            break;
+
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            constant = code[1];
+            tag = CONSTANT_STRING;
+            cache = readU16Operand(code + 2);
+            break;
+
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+            constant = readU24Operand(code + 1);
+            tag = CONSTANT_STRING;
+            cache = readU16Operand(code + 4);
+            break;
+
+        case OP_INVOKE:
+            constant = code[1];
+            tag = CONSTANT_STRING;
+            cache = readU16Operand(code + 3);
+            break;
+
+        case OP_INVOKE_LONG:
+            constant = readU24Operand(code + 1);
+            tag = CONSTANT_STRING;
+            cache = readU16Operand(code + 5);
+            break;
+
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            if (code[1] >= function->upvalueCount) return 0;
+            break;
+
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUBTRACT_LOCAL_CONST:
+        case OP_LESS_LOCAL_CONST_JUMP:
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            constant = code[2];
+            tag = CONSTANT_NUMBER;
+            break;
+
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL: {
+            int slot = readU16Operand(code + 1);
+
+            if (slot >= reader->globalCount || reader->globalSlots[slot] > UINT16_MAX) return 0;
+
+            if (reader->relocate) {
+                slot = reader->globalSlots[slot];
+                code[1] = (slot >> 8) & 0xff;
+                code[2] = slot & 0xff;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (constant != -1 && !hasConstant(chunk, constant, tag)) return 0;
+    if (cache >= chunk->cacheCount) return 0;
+
+    return length;
+}
+
+// The VM trusts every operand, and a file can get past the header and still
+// be truncated or corrupt, so each instruction in [function] is checked before
+// it can run. Jumps must also land on the start of an instruction, and the
+// last one must not run off the end of the chunk. How the instructions use
+// the stack is not checked: that would take a full verifier, and the header
+// checks already turn away files written by any other VM.
+static void checkChunk(GhostVM *vm, Reader* reader, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+
+    if (chunk->count == 0) {
+        reader->failed = true;
+        return;
+    }
+
+    bool* starts = ALLOCATE(vm, bool, chunk->count);
+    memset(starts, 0, chunk->count * sizeof(bool));
+
+    int last = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        int length = checkInstruction(reader, function, offset);
+
+        if (length == 0) {
+            reader->failed = true;
+            break;
+        }
+
+        starts[offset] = true;
+        last = offset;
+        offset += length;
+    }
+
+    for (int offset = 0; offset < chunk->count && !reader->failed; offset += instructionLength(chunk, offset)) {
+        int target;
+
+        if (jumpTarget(chunk, offset, &target) && (target < 0 || target >= chunk->count || !starts[target])) {
+            reader->failed = true;
+        }
+    }
+
+    uint8_t instruction = chunk->code[last];
+
+    if (instruction != OP_RETURN && instruction != OP_RETURN_LOCAL &&
+        instruction != OP_JUMP && instruction != OP_LOOP) {
+        reader->failed = true;
+    }
+
+    FREE_ARRAY(vm, bool, starts, chunk->count);
+}
+
+static ObjFunction* readFunction(GhostVM *vm, Reader* reader, int depth) {
+    // Function constants only nest as deeply as the source does.
+    if (depth > UINT8_COUNT) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    ObjFunction* function = newFunction(vm);
+    push(vm, OBJ_VAL(function));
+
+    function->arity = readU32(reader);
+    function->upvalueCount = readU32(reader);
+
+    uint8_t hasName;
+    readBytes(reader, &hasName, 1);
+
+    if (hasName) {
+        function->name = readString(vm, reader);
+        if (function->name != NULL) writeBarrier(vm, (Obj*)function, OBJ_VAL(function->name));
+    }
+
+    Chunk* chunk = &function->chunk;
+    uint32_t count = readU32(reader);
+    const char* code = readSpan(reader, count);
+
+    if (code != NULL && count > 0) {
+        chunk->code = ALLOCATE(vm, uint8_t, count);
+        chunk->lines = ALLOCATE(vm, int, count);
+        chunk->capacity = count;
+        chunk->count = count;
+        memcpy(chunk->code, code, count);
+    }
+
+    uint32_t runs = readU32(reader);
+    uint32_t filled = 0;
+
+    for (uint32_t i = 0; i < runs && !reader->failed; i++) {
+        uint32_t line = readU32(reader);
+        uint32_t run = readU32(reader);
+
+        if (run > (uint32_t)chunk->count - filled) {
+            reader->failed = true;
+            break;
+        }
+
+        for (uint32_t j = 0; j < run; j++) {
+            chunk->lines[filled++] = line;
+        }
+    }
+
+    if (filled != (uint32_t)chunk->count) reader->failed = true;
+
+    uint32_t cacheCount = readU32(reader);
+    if (cacheCount > UINT16_MAX + 1) reader->failed = true;
+
+    for (uint32_t i = 0; i < cacheCount && !reader->failed; i++) {
+        addInlineCache(vm, chunk);
+    }
+
+    uint32_t constantCount = readU32(reader);
+    if (constantCount > UINT24_MAX + 1) reader->failed = true;
+
+    for (uint32_t i = 0; i < constantCount && !reader->failed; i++) {
+        uint8_t tag;
+        readBytes(reader, &tag, 1);
+
+        Value constant = NULL_VAL;
+
+        if (tag == CONSTANT_NUMBER) {
+            double number;
+            readBytes(reader, &number, sizeof(number));
+            constant = NUMBER_VAL(number);
+        } else if (tag == CONSTANT_STRING) {
+            ObjString* string = readString(vm, reader);
+            if (string != NULL) constant = OBJ_VAL(string);
+        } else if (tag == CONSTANT_FUNCTION) {
+            ObjFunction* nested = readFunction(vm, reader, depth + 1);
+            if (nested != NULL) constant = OBJ_VAL(nested);
+        } else {
+            reader->failed = true;
+        }
+
+        addConstant(vm, chunk, constant);
+        writeBarrier(vm, (Obj*)function, constant);
+    }
+
+    if (!reader->failed) checkChunk(vm, reader, function);
+
+    if (!reader->failed) {
+        function->slotCount = maxStackDepth(vm, chunk, function->arity + 1);
+    }
+
+    pop(vm);
+    return reader->failed ? NULL : function;
+}
+
+// Loads the function cached at [path], or returns NULL if there is no usable
+// cache for a source whose hash is [sourceHash].
+static ObjFunction* readBytecode(GhostVM *vm, const char* path, uint64_t sourceHash) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1) return NULL;
+
+    struct stat status;
+
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        close(descriptor);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+
+    if (data == MAP_FAILED) return NULL;
+
+    Reader reader;
+    reader.data = data;
+    reader.length = status.st_size;
+    reader.position = 0;
+    reader.failed = false;
+    reader.globalCount = 0;
+    reader.globalSlots = NULL;
+    reader.relocate = false;
+
+    uint32_t magic = readU32(&reader);
+    uint32_t format = readU32(&reader);
+
+    uint64_t fingerprint;
+    uint64_t fileSourceHash;
+    readBytes(&reader, &fingerprint, sizeof(fingerprint));
+    readBytes(&reader, &fileSourceHash, sizeof(fileSourceHash));
+
+    ObjFunction* function = NULL;
+
+    if (!reader.failed && magic == BYTECODE_MAGIC && format == BYTECODE_FORMAT &&
+        fingerprint == vmFingerprint() && fileSourceHash == sourceHash) {
+        uint32_t globalCount = readU32(&reader);
+
+        if (globalCount <= UINT16_MAX + 1) {
+            reader.globalCount = globalCount;
+            reader.globalSlots = ALLOCATE(vm, int, globalCount);
+        } else {
+            reader.failed = true;
+        }
+
+        for (int i = 0; i < reader.globalCount && !reader.failed; i++) {
+            ObjString* name = readString(vm, &reader);
+            if (name == NULL) break;
+
+            push(vm, OBJ_VAL(name));
+            reader.globalSlots[i] = declareGlobal(vm, name);
+            pop(vm);
+
+            if (reader.globalSlots[i] != i) reader.relocate = true;
+        }
+
+        if (!reader.failed) function = readFunction(vm, &reader, 0);
+        if (reader.position != reader.length) function = NULL;
+
+        FREE_ARRAY(vm, int, reader.globalSlots, reader.globalCount);
+    }
+
+    munmap(data, status.st_size);
+    return function;
+}
+
+// Returns the path of the cache for the source at [path]: "script.ghost" is
+// cached in "script.ghostc", and any other name gets ".ghostc" appended.
+static char* cachePath(const char* path) {
+    size_t length = strlen(path);
+    bool ghost = length >= 6 && strcmp(path + length - 6, ".ghost") == 0;
+
+    char* cache = malloc(length + 8);
+    if (cache == NULL) return NULL;
+
+    memcpy(cache, path, length);
+    strcpy(cache + length, ghost ? "c" : ".ghostc");
+    return cache;
+}
+
+ObjFunction* compileFile(GhostVM *vm, const char* path) {
+    char* source = readFile(path);
+
+    if (!vm->cacheBytecode) {
+        ObjFunction* function = ghostCompile(vm, source);
+        free(source);
+        return function;
+    }
+
+    uint64_t sourceHash = hashBytes(HASH_SEED, source, strlen(source));
+    char* cache = cachePath(path);
+
+    ObjFunction* function = cache != NULL ? readBytecode(vm, cache, sourceHash) : NULL;
+
+    if (function == NULL) {
+        function = ghostCompile(vm, source);
+
+        if (function != NULL && cache != NULL) writeBytecode(vm, function, cache, sourceHash);
+    }
+
+    free(cache);
+    free(source);
+    return function;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef ghost_bytecode_h
+#define ghost_bytecode_h
+
+#include "include/ghost.h"
+#include "object.h"
+
+// Compiles the source file at [path]. When the VM caches bytecode, a ".ghostc"
+// file next to the source is loaded instead if it was written by this VM for
+// the same source, and written afterwards otherwise.
+//
+// Returns NULL if the source has a compile error.
+ObjFunction* compileFile(GhostVM *vm, const char* path);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "include/ghost.h"
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 void initChunk(Chunk* chunk) {
@@ -10,6 +11,8 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->cacheCount = 0;
+    chunk->caches = NULL;
 
     initValueArray(&chunk->constants);
 }
@@ -17,6 +20,7 @@ void initChunk(Chunk* chunk) {
 void freeChunk(GhostVM *vm, Chunk* chunk) {
     FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(vm, int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(vm, InlineCache, chunk->caches, chunk->cacheCount);
 
     freeValueArray(vm, &chunk->constants);
 
@@ -42,4 +46,252 @@ int addConstant(GhostVM *vm, Chunk* chunk, Value value) {
     pop(vm);
 
     return chunk->constants.count - 1;
+}
+
+int addInlineCache(GhostVM *vm, Chunk* chunk) {
+    chunk->caches = GROW_ARRAY(vm, chunk->caches, InlineCache, chunk->cacheCount, chunk->cacheCount + 1);
+
+    InlineCache* cache = &chunk->caches[chunk->cacheCount];
+    cache->count = 0;
+
+    for (int i = 0; i < INLINE_CACHE_WAYS; i++) {
+        cache->entries[i].classVersion = 0;
+        cache->entries[i].shape = NULL;
+        cache->entries[i].fieldSlot = -1;
+        cache->entries[i].method = NULL_VAL;
+        cache->entries[i].transition = NULL;
+    }
+
+    return chunk->cacheCount++;
+}
+
+// Returns how many bytes the instruction at [offset] takes up, including its
+// operands.
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_SET_LOCAL_POP:
+        case OP_RETURN_LOCAL:
+            return 2;
+
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_SUPER_INVOKE:
+        case OP_GET_LOCAL_GET_LOCAL:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUBTRACT_LOCAL_CONST:
+            return 3;
+
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_CONSTANT_LONG:
+        case OP_GET_SUPER_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+            return 4;
+
+        case OP_INVOKE:
+        case OP_LESS_LOCAL_CONST_JUMP:
+        case OP_GREATER_LOCAL_CONST_JUMP:
+        case OP_SUPER_INVOKE_LONG:
+            return 5;
+
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+            return 6;
+
+        case OP_INVOKE_LONG:
+            return 7;
+
+        case OP_CLOSURE: {
+            // Each upvalue the closure captures is described by three bytes:
+            // whether it is a local and its two byte index.
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 3;
+        }
+
+        case OP_CLOSURE_LONG: {
+            uint8_t* operand = &chunk->code[offset + 1];
+            int constant = (operand[0] << 16) | (operand[1] << 8) | operand[2];
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            return 4 + function->upvalueCount * 3;
+        }
+
+        default:
+            return 1;
+    }
+}
+
+// Returns how the instruction at [offset] changes the height of the value
+// stack once it has run.
+static int stackEffect(Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NEW_LIST:
+        case OP_NEW_MAP:
+        case OP_GET_LOCAL:
+        case OP_GET_LOCAL_LONG:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG:
+        case OP_CLASS:
+        case OP_CLASS_LONG:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUBTRACT_LOCAL_CONST:
+            return 1;
+
+        case OP_GET_LOCAL_GET_LOCAL:
+            return 2;
+
+        case OP_ADD_LIST:
+        case OP_SUBSCRIPT:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_PROPERTY:
+        case OP_SET_PROPERTY_LONG:
+        case OP_GET_SUPER:
+        case OP_GET_SUPER_LONG:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_GREATER_EQUAL_NUM:
+        case OP_LESS_EQUAL_NUM:
+        case OP_CLOSE_UPVALUE:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_METHOD_LONG:
+        case OP_SET_LOCAL_POP:
+            return -1;
+
+        case OP_ADD_MAP:
+        case OP_SUBSCRIPT_ASSIGN:
+            return -2;
+
+        // The callee, or the receiver, is replaced by the result.
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INVOKE:
+            return -code[1];
+        case OP_INVOKE_LONG:
+            return -code[4];
+
+        // As above, and the superclass is popped too.
+        case OP_SUPER_INVOKE:
+            return -code[2] - 1;
+        case OP_SUPER_INVOKE_LONG:
+            return -code[4] - 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Returns the most values the function owning [chunk] can have on its stack
+// at once, counting the [initialDepth] slots of the callee and its arguments
+// that are already there when it is called. This follows every path through
+// the code, as a jump lands with the same stack height whichever way it is
+// reached.
+int maxStackDepth(GhostVM *vm, Chunk* chunk, int initialDepth) {
+    if (chunk->count == 0) return initialDepth;
+
+    // The height of the stack before each instruction, or -1 for those not
+    // reached yet, and the instructions still to be followed.
+    int* depths = ALLOCATE(vm, int, chunk->count);
+    int* pending = ALLOCATE(vm, int, chunk->count);
+    int pendingCount = 0;
+
+    for (int i = 0; i < chunk->count; i++) depths[i] = -1;
+
+    depths[0] = initialDepth;
+    pending[pendingCount++] = 0;
+    int maxDepth = initialDepth;
+
+    while (pendingCount > 0) {
+        int offset = pending[--pendingCount];
+
+        // Follows straight-line code until it ends or runs into code that has
+        // already been followed.
+        for (;;) {
+            uint8_t instruction = chunk->code[offset];
+            int next = offset + instructionLength(chunk, offset);
+            int depth = depths[offset] + stackEffect(chunk, offset);
+            int target = -1;
+
+            if (depth > maxDepth) maxDepth = depth;
+
+            switch (instruction) {
+                case OP_JUMP:
+                case OP_JUMP_IF_FALSE:
+                case OP_JUMP_IF_TRUE:
+                    target = next + ((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+                    break;
+                case OP_LOOP:
+                    target = next - ((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+                    break;
+                case OP_LESS_LOCAL_CONST_JUMP:
+                case OP_GREATER_LOCAL_CONST_JUMP:
+                    target = next + ((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+                    break;
+                default:
+                    break;
+            }
+
+            if (target >= 0 && target < chunk->count && depths[target] == -1) {
+                depths[target] = depth;
+                pending[pendingCount++] = target;
+            }
+
+            if (instruction == OP_JUMP || instruction == OP_LOOP ||
+                instruction == OP_RETURN || instruction == OP_RETURN_LOCAL) {
+                break;
+            }
+
+            if (next >= chunk->count || depths[next] != -1) break;
+
+            depths[next] = depth;
+            offset = next;
+        }
+    }
+
+    FREE_ARRAY(vm, int, depths, chunk->count);
+    FREE_ARRAY(vm, int, pending, chunk->count);
+
+    return maxDepth;
 }
\ No newline at end of file
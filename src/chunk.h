@@ -6,61 +6,58 @@
 #include "value.h"
 
 typedef enum {
-    OP_CONSTANT,
-    OP_NULL,
-    OP_TRUE,
-    OP_FALSE,
-    OP_NEW_LIST,
-    OP_ADD_LIST,
-    OP_SUBSCRIPT,
-    OP_SUBSCRIPT_ASSIGN,
-    OP_POP,
-    OP_GET_LOCAL,
-    OP_SET_LOCAL,
-    OP_GET_GLOBAL,
-    OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL,
-    OP_GET_UPVALUE,
-    OP_SET_UPVALUE,
-    OP_GET_PROPERTY,
-    OP_SET_PROPERTY,
-    OP_GET_SUPER,
-    OP_EQUAL,
-    OP_GREATER,
-    OP_LESS,
-    OP_ADD,
-    OP_SUBTRACT,
-    OP_MULTIPLY,
-    OP_DIVIDE,
-    OP_MODULO,
-    OP_NOT,
-    OP_NEGATE,
-    OP_JUMP,
-    OP_JUMP_IF_FALSE,
-    OP_LOOP,
-    OP_CALL,
-    OP_INVOKE,
-    OP_SUPER_INVOKE,
-    OP_CLOSURE,
-    OP_CLOSE_UPVALUE,
-    OP_RETURN,
-    OP_CLASS,
-    OP_INHERIT,
-    OP_METHOD,
-    OP_INCLUDE,
+    #define OPCODE(name) OP_##name,
+    #include "opcodes.h"
+    #undef OPCODE
 } OpCode;
 
+// Every property access and method invocation site gets its own inline cache.
+// It remembers the kinds of instances seen at that site, identified by their
+// class and shape, along with what the lookup resolved to: either the slot
+// holding the field, or the method closure. A site that has only seen one kind
+// is monomorphic, one with a few is polymorphic. Once it sees more than
+// INLINE_CACHE_WAYS kinds it becomes megamorphic and stops caching altogether.
+#define INLINE_CACHE_WAYS 4
+#define INLINE_CACHE_MEGAMORPHIC (INLINE_CACHE_WAYS + 1)
+
+typedef struct {
+    // The version of the class and the shape of the instances this entry was
+    // filled for.
+    uint64_t classVersion;
+    struct sShape* shape;
+
+    // The slot holding the field, or -1 if the name resolved to a method.
+    int fieldSlot;
+
+    // The method closure when [fieldSlot] is -1.
+    Value method;
+
+    // For a store that adds the field, the shape the instance moves to.
+    struct sShape* transition;
+} InlineCacheEntry;
+
+typedef struct {
+    int count;
+    InlineCacheEntry entries[INLINE_CACHE_WAYS];
+} InlineCache;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
+
+    int cacheCount;
+    InlineCache* caches;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(GhostVM *vm, Chunk* chunk);
 void writeChunk(GhostVM *vm, Chunk* chunk, uint8_t byte, int line);
 int addConstant(GhostVM *vm, Chunk* chunk, Value value);
+int addInlineCache(GhostVM *vm, Chunk* chunk);
+int instructionLength(Chunk* chunk, int offset);
+int maxStackDepth(GhostVM *vm, Chunk* chunk, int initialDepth);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "common.h"
 #include "compiler.h"
 #include "memory.h"
+#include "optimizer.h"
 #include "scanner.h"
 
 #if DEBUG_PRINT_CODE
@@ -48,7 +49,7 @@ typedef struct {
 } Local;
 
 typedef struct {
-    uint8_t index;
+    uint16_t index;
     bool isLocal;
 } Upvalue;
 
@@ -64,10 +65,17 @@ typedef struct Compiler {
     ObjFunction* function;
     FunctionType type;
 
-    Local locals[UINT8_COUNT];
+    // Grown on demand, as generated code can declare far more locals than
+    // most functions ever need.
+    Local* locals;
     int localCount;
+    int localCapacity;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+
+    // The offset just past the most recent OP_CALL, so that a return
+    // statement can tell whether its value comes straight from a call.
+    int lastCall;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -186,20 +194,46 @@ static void emitReturn(GhostVM *vm)
     emitByte(vm, OP_RETURN);
 }
 
-static uint8_t makeConstant(GhostVM *vm, Value value) {
+static int makeConstant(GhostVM *vm, Value value) {
     int constant = addConstant(vm, currentChunk(), value);
+    writeBarrier(vm, (Obj*)current->function, value);
 
-    if (constant > UINT8_MAX) {
+    if (constant > UINT24_MAX) {
         error("Too many constants in one chunk");
 
         return 0;
     }
 
-    return (uint8_t) constant;
+    return constant;
+}
+
+// Emits an instruction whose operand is a constant index. The first 256
+// constants fit the one byte operand of [instruction]; past that the wide
+// [longInstruction] takes a three byte operand instead.
+static void emitConstantOp(GhostVM *vm, uint8_t instruction, uint8_t longInstruction, int constant) {
+    if (constant <= UINT8_MAX) {
+        emitBytes(vm, instruction, (uint8_t)constant);
+    } else {
+        emitByte(vm, longInstruction);
+        emitByte(vm, (constant >> 16) & 0xff);
+        emitBytes(vm, (constant >> 8) & 0xff, constant & 0xff);
+    }
 }
 
 static void emitConstant(GhostVM *vm, Value value) {
-    emitBytes(vm, OP_CONSTANT, makeConstant(vm, value));
+    emitConstantOp(vm, OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(vm, value));
+}
+
+// Reserves an inline cache for the property access or invocation just emitted
+// and writes its index as a two byte operand.
+static void emitInlineCache(GhostVM *vm) {
+    int cache = addInlineCache(vm, currentChunk());
+
+    if (cache > UINT16_MAX) {
+        error("Too many property accesses in one chunk.");
+    }
+
+    emitBytes(vm, (cache >> 8) & 0xff, cache & 0xff);
 }
 
 static void patchJump(int offset) {
@@ -218,15 +252,22 @@ static void initCompiler(GhostVM *vm, Compiler* compiler, FunctionType type) {
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
     compiler->scopeDepth = 0;
+    compiler->lastCall = -1;
     compiler->function = newFunction(vm);
     current = compiler;
 
     if (type != TYPE_SCRIPT) {
         current->function->name = copyString(vm, parser.previous.start, parser.previous.length);
+        writeBarrier(vm, (Obj*)current->function, OBJ_VAL(current->function->name));
     }
 
+    compiler->localCapacity = GROW_CAPACITY(0);
+    compiler->locals = GROW_ARRAY(vm, NULL, Local, 0, compiler->localCapacity);
+
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
@@ -244,6 +285,14 @@ static ObjFunction* endCompiler(GhostVM *vm) {
     emitReturn(vm);
     ObjFunction* function = current->function;
 
+    #if OPTIMIZE_BYTECODE
+        if (!parser.hadError) optimizeFunction(vm, function);
+    #endif
+
+    if (!parser.hadError) {
+        function->slotCount = maxStackDepth(vm, &function->chunk, function->arity + 1);
+    }
+
     #if DEBUG_PRINT_CODE
         if (!parser.hadError) {
             disassembleChunk(currentChunk(),
@@ -251,6 +300,8 @@ static ObjFunction* endCompiler(GhostVM *vm) {
         }
     #endif
 
+    FREE_ARRAY(vm, Local, current->locals, current->localCapacity);
+
     current = current->enclosing;
     return function;
 }
@@ -283,10 +334,32 @@ static void declaration();
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(GhostVM *vm, Precedence precedence);
 
-static uint8_t identifierConstant(GhostVM *vm, Token* name) {
+static int identifierConstant(GhostVM *vm, Token* name) {
     return makeConstant(vm, OBJ_VAL(copyString(vm, name->start, name->length)));
 }
 
+// Returns the VM-wide slot of the global variable [name]. Globals are resolved
+// at compile time so the VM can find them by index instead of by hashing.
+static int globalSlot(GhostVM *vm, Token* name) {
+    ObjString* string = copyString(vm, name->start, name->length);
+
+    push(vm, OBJ_VAL(string));
+    int slot = declareGlobal(vm, string);
+    pop(vm);
+
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
+
+static void emitGlobal(GhostVM *vm, uint8_t instruction, int slot) {
+    emitByte(vm, instruction);
+    emitBytes(vm, (slot >> 8) & 0xff, slot & 0xff);
+}
+
 static bool identifiersEqual(Token* a, Token* b) {
     if (a->length != b->length) return false;
 
@@ -309,7 +382,7 @@ static int resolveLocal(Compiler* compiler, Token* name) {
     return -1;
 }
 
-static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
+static int addUpvalue(Compiler* compiler, int index, bool isLocal) {
     int upvalueCount = compiler->function->upvalueCount;
 
     for (int i = 0; i < upvalueCount; i++) {
@@ -325,7 +398,7 @@ static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
     }
 
     compiler->upvalues[upvalueCount].isLocal = isLocal;
-    compiler->upvalues[upvalueCount].index = index;
+    compiler->upvalues[upvalueCount].index = (uint16_t)index;
     return compiler->function->upvalueCount++;
 }
 
@@ -335,30 +408,36 @@ static int resolveUpvalue(Compiler* compiler, Token* name) {
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        return addUpvalue(compiler, local, true);
     }
 
     int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, upvalue, false);
     }
 
     return -1;
 }
 
-static void addLocal(Token name) {
-    if (current->localCount == UINT8_COUNT) {
+static void addLocal(GhostVM *vm, Token name) {
+    if (current->localCount == UINT16_COUNT) {
         error("Too many local variables in function.");
         return;
     }
 
+    if (current->localCount == current->localCapacity) {
+        int oldCapacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(oldCapacity);
+        current->locals = GROW_ARRAY(vm, current->locals, Local, oldCapacity, current->localCapacity);
+    }
+
     Local* local = &current->locals[current->localCount++];
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
 }
 
-static void declareVariable() {
+static void declareVariable(GhostVM *vm) {
     // Global variables are implicitly declared
     if (current->scopeDepth == 0) return;
 
@@ -376,17 +455,17 @@ static void declareVariable() {
         }
     }
 
-    addLocal(*name);
+    addLocal(vm, *name);
 }
 
-static uint8_t parseVariable(GhostVM *vm, const char *errorMessage)
+static int parseVariable(GhostVM *vm, const char *errorMessage)
 {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
-    declareVariable();
+    declareVariable(vm);
     if (current->scopeDepth > 0) return 0;
 
-    return identifierConstant(vm, &parser.previous);
+    return globalSlot(vm, &parser.previous);
 }
 
 static void markInitialized() {
@@ -395,14 +474,14 @@ static void markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(GhostVM *vm, uint8_t global)
+static void defineVariable(GhostVM *vm, int global)
 {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
 
-    emitBytes(vm, OP_DEFINE_GLOBAL, global);
+    emitGlobal(vm, OP_DEFINE_GLOBAL, global);
 }
 
 static uint8_t argumentList(GhostVM *vm) {
@@ -463,6 +542,7 @@ static void binary(GhostVM *vm, bool canAssign) {
 static void call(GhostVM *vm, bool canAssign) {
     uint8_t argCount = argumentList(vm);
     emitBytes(vm, OP_CALL, argCount);
+    current->lastCall = currentChunk()->count;
 }
 
 static void list(GhostVM *vm, bool canAssign) {
@@ -480,6 +560,25 @@ static void list(GhostVM *vm, bool canAssign) {
     consume(TOKEN_RIGHT_BRACKET, "Expected closing ']'");
 }
 
+// A '{' that starts an expression, rather than a statement, opens a map
+// literal of "key: value" pairs.
+static void map(GhostVM *vm, bool canAssign) {
+    emitByte(vm, OP_NEW_MAP);
+
+    do {
+        if (check(TOKEN_RIGHT_BRACE)) {
+            break;
+        }
+
+        expression(vm);
+        consume(TOKEN_COLON, "Expected ':' after map key");
+        expression(vm);
+        emitByte(vm, OP_ADD_MAP);
+    } while (match(TOKEN_COMMA));
+
+    consume(TOKEN_RIGHT_BRACE, "Expected closing '}'");
+}
+
 static void subscript(GhostVM *vm, bool canAssign) {
     expression(vm);
     consume(TOKEN_RIGHT_BRACKET, "Expected closing ']'");
@@ -494,17 +593,20 @@ static void subscript(GhostVM *vm, bool canAssign) {
 
 static void dot(GhostVM *vm, bool canAssign) {
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(vm, &parser.previous);
+    int name = identifierConstant(vm, &parser.previous);
 
     if (canAssign && match(TOKEN_EQUAL)) {
         expression(vm);
-        emitBytes(vm, OP_SET_PROPERTY, name);
+        emitConstantOp(vm, OP_SET_PROPERTY, OP_SET_PROPERTY_LONG, name);
+        emitInlineCache(vm);
     } else if (match(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList(vm);
-        emitBytes(vm, OP_INVOKE, name);
+        emitConstantOp(vm, OP_INVOKE, OP_INVOKE_LONG, name);
         emitByte(vm, argCount);
+        emitInlineCache(vm);
     } else {
-        emitBytes(vm, OP_GET_PROPERTY, name);
+        emitConstantOp(vm, OP_GET_PROPERTY, OP_GET_PROPERTY_LONG, name);
+        emitInlineCache(vm);
     }
 }
 
@@ -556,23 +658,40 @@ static void namedVariable(GhostVM *vm, Token name, bool canAssign) {
     uint8_t getOp, setOp;
     int arg = resolveLocal(current, &name);
 
-    if (arg != -1) {
+    if (arg > UINT8_MAX) {
+        getOp = OP_GET_LOCAL_LONG;
+        setOp = OP_SET_LOCAL_LONG;
+    } else if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     } else if ((arg = resolveUpvalue(current, &name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(vm, &name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        arg = globalSlot(vm, &name);
+
+        if (canAssign && match(TOKEN_EQUAL)) {
+            expression(vm);
+            emitGlobal(vm, OP_SET_GLOBAL, arg);
+        } else {
+            emitGlobal(vm, OP_GET_GLOBAL, arg);
+        }
+
+        return;
     }
 
     if (canAssign && match(TOKEN_EQUAL)) {
         expression(vm);
-        emitBytes(vm, setOp, (uint8_t)arg);
+        emitByte(vm, setOp);
     } else {
-        emitBytes(vm, getOp, (uint8_t)arg);
+        emitByte(vm, getOp);
+    }
+
+    // Only locals past the 256th need the wide, two byte slot operand.
+    if (arg > UINT8_MAX) {
+        emitBytes(vm, (arg >> 8) & 0xff, arg & 0xff);
+    } else {
+        emitByte(vm, (uint8_t)arg);
     }
 }
 
@@ -597,18 +716,18 @@ static void super_(GhostVM *vm, bool canAssign) {
 
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(vm, &parser.previous);
+    int name = identifierConstant(vm, &parser.previous);
 
     namedVariable(vm, syntheticToken("this"), false);
 
     if (match(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList(vm);
         namedVariable(vm, syntheticToken("super"), false);
-        emitBytes(vm, OP_SUPER_INVOKE, name);
+        emitConstantOp(vm, OP_SUPER_INVOKE, OP_SUPER_INVOKE_LONG, name);
         emitByte(vm, argCount);
     } else {
         namedVariable(vm, syntheticToken("super"), false);
-        emitBytes(vm, OP_GET_SUPER, name);
+        emitConstantOp(vm, OP_GET_SUPER, OP_GET_SUPER_LONG, name);
     }
 }
 
@@ -640,7 +759,7 @@ static void unary(GhostVM *vm, bool canAssign) {
 ParseRule rules[] = {
     {grouping, call, PREC_CALL},     // TOKEN_LEFT_PAREN
     {NULL, NULL, PREC_NONE},         // TOKEN_RIGHT_PAREN
-    {NULL, NULL, PREC_NONE},         // TOKEN_LEFT_BRACE
+    {map, NULL, PREC_NONE},          // TOKEN_LEFT_BRACE
     {NULL, NULL, PREC_NONE},         // TOKEN_RIGHT_BRACE
     {list, subscript, PREC_CALL},    // TOKEN_LEFT_BRACKET
     {NULL, NULL, PREC_NONE},         // TOKEN_RIGHT_BRACKET
@@ -652,6 +771,7 @@ ParseRule rules[] = {
     {NULL, binary, PREC_FACTOR},     // TOKEN_SLASH
     {NULL, binary, PREC_FACTOR},     // TOKEN_STAR
     {NULL, binary, PREC_TERM},       // TOKEN_PERCENT
+    {NULL, NULL, PREC_NONE},         // TOKEN_COLON
     {unary, NULL, PREC_NONE},        // TOKEN_BANG
     {NULL, binary, PREC_EQUALITY},   // TOKEN_BANG_EQUAL
     {NULL, NULL, PREC_NONE},         // TOKEN_EQUAL
@@ -680,6 +800,7 @@ ParseRule rules[] = {
     {NULL, NULL, PREC_NONE},         // TOKEN_WHILE
     {NULL, NULL, PREC_NONE},         // TOKEN_EXTENDS
     {NULL, NULL, PREC_NONE},         // TOKEN_INCLUDE
+    {NULL, NULL, PREC_NONE},         // TOKEN_IMPORT
     {NULL, NULL, PREC_NONE},         // TOKEN_ERROR
     {NULL, NULL, PREC_NONE},         // TOKEN_EOF
 };
@@ -742,7 +863,7 @@ static void function(GhostVM *vm, FunctionType type) {
                 errorAtCurrent("Cannot have more than 255 parameters.");
             }
 
-            uint8_t paramConstant = parseVariable(vm, "Expect parameter name.");
+            int paramConstant = parseVariable(vm, "Expect parameter name.");
             defineVariable(vm, paramConstant);
         } while (match(TOKEN_COMMA));
     }
@@ -755,17 +876,17 @@ static void function(GhostVM *vm, FunctionType type) {
 
     // Create the function object
     ObjFunction *function = endCompiler(vm);
-    emitBytes(vm, OP_CLOSURE, makeConstant(vm, OBJ_VAL(function)));
+    emitConstantOp(vm, OP_CLOSURE, OP_CLOSURE_LONG, makeConstant(vm, OBJ_VAL(function)));
 
     for (int i = 0; i < function->upvalueCount; i++) {
         emitByte(vm, compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(vm, compiler.upvalues[i].index);
+        emitBytes(vm, (compiler.upvalues[i].index >> 8) & 0xff, compiler.upvalues[i].index & 0xff);
     }
 }
 
 static void method(GhostVM *vm) {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(vm, &parser.previous);
+    int constant = identifierConstant(vm, &parser.previous);
 
     FunctionType type = TYPE_METHOD;
 
@@ -775,17 +896,19 @@ static void method(GhostVM *vm) {
 
     function(vm, type);
 
-    emitBytes(vm, OP_METHOD, constant);
+    emitConstantOp(vm, OP_METHOD, OP_METHOD_LONG, constant);
 }
 
 static void classDeclaration(GhostVM *vm) {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(vm, &parser.previous);
-    declareVariable();
+    int nameConstant = identifierConstant(vm, &parser.previous);
+    declareVariable(vm);
 
-    emitBytes(vm, OP_CLASS, nameConstant);
-    defineVariable(vm, nameConstant);
+    int global = current->scopeDepth > 0 ? 0 : globalSlot(vm, &className);
+
+    emitConstantOp(vm, OP_CLASS, OP_CLASS_LONG, nameConstant);
+    defineVariable(vm, global);
 
     ClassCompiler classCompiler;
     classCompiler.name = parser.previous;
@@ -802,7 +925,7 @@ static void classDeclaration(GhostVM *vm) {
         }
 
         beginScope();
-        addLocal(syntheticToken("super"));
+        addLocal(vm, syntheticToken("super"));
         defineVariable(vm, 0);
 
         namedVariable(vm, className, false);
@@ -828,14 +951,14 @@ static void classDeclaration(GhostVM *vm) {
 }
 
 static void functionDeclaration(GhostVM *vm) {
-    uint8_t global = parseVariable(vm, "Expect function name.");
+    int global = parseVariable(vm, "Expect function name.");
     markInitialized();
     function(vm, TYPE_FUNCTION);
     defineVariable(vm, global);
 }
 
 static void letDeclaration(GhostVM *vm) {
-    uint32_t global = parseVariable(vm, "Expect variable name.");
+    int global = parseVariable(vm, "Expect variable name.");
 
     if (match(TOKEN_EQUAL)) {
         expression(vm);
@@ -923,12 +1046,20 @@ static void ifStatement(GhostVM *vm) {
     patchJump(elseJump);
 }
 
-static void includeStatement(GhostVM *vm) {
-    consume(TOKEN_STRING, "Expect a string after include");
+// Compiles an include, which runs a file every time it is reached, or an
+// import, which runs it at most once.
+static void includeStatement(GhostVM *vm, uint8_t instruction, const char* keyword) {
+    char message[64];
+
+    snprintf(message, sizeof(message), "Expect a string after %s", keyword);
+    consume(TOKEN_STRING, message);
     emitConstant(vm, OBJ_VAL(copyString(vm, parser.previous.start + 1, parser.previous.length - 2)));
-    consume(TOKEN_SEMICOLON, "Expect ';' after include.");
 
-    emitByte(vm, OP_INCLUDE);
+    snprintf(message, sizeof(message), "Expect ';' after %s.", keyword);
+    consume(TOKEN_SEMICOLON, message);
+
+    // The file's body is called like a function, so discard what it returns.
+    emitBytes(vm, instruction, OP_POP);
 }
 
 static void returnStatement(GhostVM *vm) {
@@ -945,6 +1076,14 @@ static void returnStatement(GhostVM *vm) {
 
         expression(vm);
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // Nothing is left to do with the result of a call in tail position
+        // but return it, so the callee can take over this call's frame. The
+        // OP_RETURN stays for jumps that skip the call, as in "a and f()".
+        if (current->lastCall == currentChunk()->count) {
+            currentChunk()->code[current->lastCall - 2] = OP_TAIL_CALL;
+        }
+
         emitByte(vm, OP_RETURN);
     }
 }
@@ -982,6 +1121,7 @@ static void synchronize() {
             case TOKEN_WHILE:
             case TOKEN_EXTENDS:
             case TOKEN_INCLUDE:
+            case TOKEN_IMPORT:
             case TOKEN_RETURN:
                 return;
 
@@ -1016,7 +1156,9 @@ static void statement(GhostVM *vm) {
     } else if (match(TOKEN_RETURN)) {
         returnStatement(vm);
     } else if (match(TOKEN_INCLUDE)) {
-        includeStatement(vm);
+        includeStatement(vm, OP_INCLUDE, "include");
+    } else if (match(TOKEN_IMPORT)) {
+        includeStatement(vm, OP_IMPORT, "import");
     } else if (match(TOKEN_WHILE)) {
         whileStatement(vm);
     } else if (match(TOKEN_LEFT_BRACE)) {
@@ -22,6 +22,6 @@
 #include "vm.h"
 
 ObjFunction* ghostCompile(GhostVM *vm, const char* source);
-void markCompilerRoots();
+void markCompilerRoots(GhostVM *vm);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "../include/ghost.h"
+#include "floatarray.h"
+#include "../modules/modules.h"
+#include "../simd.h"
+#include "../vm.h"
+
+// Each method is given its receiver in args[0] followed by its [argCount]
+// arguments. The bulk operations change the receiver in place and return it,
+// so they can be chained.
+
+static bool expectNumber(GhostVM *vm, const char *method, int argCount, Value *args, double *number)
+{
+    if (argCount != 1 || !IS_NUMBER(args[1]))
+    {
+        runtimeError(vm, "Float64Array.%s() expects a number argument.", method);
+        return false;
+    }
+
+    *number = AS_NUMBER(args[1]);
+    return true;
+}
+
+static bool expectArray(GhostVM *vm, const char *method, int argCount, Value *args, ObjFloatArray **other)
+{
+    if (argCount != 1 || !IS_FLOAT_ARRAY(args[1]))
+    {
+        runtimeError(vm, "Float64Array.%s() expects a Float64Array argument.", method);
+        return false;
+    }
+
+    *other = AS_FLOAT_ARRAY(args[1]);
+
+    if ((*other)->count != AS_FLOAT_ARRAY(args[0])->count)
+    {
+        runtimeError(vm, "Float64Array.%s() expects arrays of the same length.", method);
+        return false;
+    }
+
+    return true;
+}
+
+static Value floatArrayLength(GhostVM *vm, int argCount, Value *args)
+{
+    return NUMBER_VAL(AS_FLOAT_ARRAY(args[0])->count);
+}
+
+static Value floatArrayAdd(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    ObjFloatArray *other;
+
+    if (!expectArray(vm, "add", argCount, args, &other)) return NULL_VAL;
+
+    simdAdd(array->values, other->values, array->count);
+    return args[0];
+}
+
+static Value floatArrayMul(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    ObjFloatArray *other;
+
+    if (!expectArray(vm, "mul", argCount, args, &other)) return NULL_VAL;
+
+    simdMultiply(array->values, other->values, array->count);
+    return args[0];
+}
+
+static Value floatArrayDot(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    ObjFloatArray *other;
+
+    if (!expectArray(vm, "dot", argCount, args, &other)) return NULL_VAL;
+
+    return NUMBER_VAL(simdDot(array->values, other->values, array->count));
+}
+
+static Value floatArraySum(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    return NUMBER_VAL(simdSum(array->values, array->count));
+}
+
+static Value floatArrayScale(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    double factor;
+
+    if (!expectNumber(vm, "scale", argCount, args, &factor)) return NULL_VAL;
+
+    simdScale(array->values, factor, array->count);
+    return args[0];
+}
+
+static Value floatArrayFill(GhostVM *vm, int argCount, Value *args)
+{
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    double value;
+
+    if (!expectNumber(vm, "fill", argCount, args, &value)) return NULL_VAL;
+
+    simdFill(array->values, value, array->count);
+    return args[0];
+}
+
+void registerFloatArrayMethods(GhostVM *vm)
+{
+    ObjString *name = externalString(vm, "Float64Array", 12);
+    push(vm, OBJ_VAL(name));
+    vm->floatArrayClass = newNativeClass(vm, name);
+
+    defineNativeMethod(vm, vm->floatArrayClass, "length", floatArrayLength);
+    defineNativeMethod(vm, vm->floatArrayClass, "add", floatArrayAdd);
+    defineNativeMethod(vm, vm->floatArrayClass, "mul", floatArrayMul);
+    defineNativeMethod(vm, vm->floatArrayClass, "dot", floatArrayDot);
+    defineNativeMethod(vm, vm->floatArrayClass, "sum", floatArraySum);
+    defineNativeMethod(vm, vm->floatArrayClass, "scale", floatArrayScale);
+    defineNativeMethod(vm, vm->floatArrayClass, "fill", floatArrayFill);
+
+    pop(vm);
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef ghost_floatarray_h
+#define ghost_floatarray_h
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "../include/ghost.h"
+
+void registerFloatArrayMethods(GhostVM *vm);
+
+#endif
\ No newline at end of file
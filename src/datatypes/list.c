@@ -1,27 +1,529 @@
-#include <ctype.h>
 #include <stdlib.h>
 
 #include "../include/ghost.h"
 #include "list.h"
+#include "../memory.h"
+#include "../modules/modules.h"
+#include "../sort.h"
 #include "../vm.h"
 
-bool static listLength(GhostVM *vm, int argCount)
+// List methods are natives that receive the list in args[0], followed by
+// their [argCount] arguments.
+
+// Reads the integer argument args[position], reporting an error for
+// [method] if it is missing or not an integer.
+static bool indexArgument(GhostVM *vm, const char *method, int argCount, Value *args, int position, int *index)
 {
-    ObjList *list = AS_LIST(pop(vm));
+    if (argCount < position || !IS_NUMBER(args[position]) || !numberToIndex(AS_NUMBER(args[position]), index))
+    {
+        runtimeError(vm, "List.%s() expects an integer argument.", method);
+        return false;
+    }
 
-    push(vm, NUMBER_VAL(list->values.count));
     return true;
 }
 
-bool declareList(GhostVM *vm, char *method, int argCount)
+// Makes room for at least [capacity] values in [list], which the caller keeps
+// reachable.
+static void reserve(GhostVM *vm, ObjList *list, int capacity)
+{
+    ValueArray *values = &list->values;
+
+    if (capacity <= values->capacity) return;
+
+    int newCapacity = GROW_CAPACITY(values->capacity);
+    if (newCapacity < capacity) newCapacity = capacity;
+
+    values->values = GROW_ARRAY(vm, values->values, Value, values->capacity, newCapacity);
+    values->capacity = newCapacity;
+}
+
+// Creates a list holding a copy of [count] [values], which the caller keeps
+// reachable.
+static ObjList *copyList(GhostVM *vm, Value *values, int count)
+{
+    ObjList *list = newList(vm);
+    push(vm, OBJ_VAL(list));
+    reserve(vm, list, count);
+    pop(vm);
+
+    for (int i = 0; i < count; i++)
+    {
+        list->values.values[i] = values[i];
+        writeBarrier(vm, (Obj*)list, values[i]);
+    }
+
+    list->values.count = count;
+    return list;
+}
+
+// Resolves a slice() bound, counting negative ones back from the end, and
+// clamps it to the list.
+static int sliceBound(int bound, int count)
+{
+    if (bound < 0) bound += count;
+    if (bound < 0) return 0;
+    if (bound > count) return count;
+    return bound;
+}
+
+static Value listLength(GhostVM *vm, int argCount, Value *args)
+{
+    return NUMBER_VAL(AS_LIST(args[0])->values.count);
+}
+
+/**
+ * Appends each argument to the list and returns its new length.
+ */
+static Value listPush(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+    reserve(vm, list, list->values.count + argCount);
+
+    for (int i = 1; i <= argCount; i++)
+    {
+        list->values.values[list->values.count++] = args[i];
+        writeBarrier(vm, (Obj*)list, args[i]);
+    }
+
+    return NUMBER_VAL(list->values.count);
+}
+
+/**
+ * Removes and returns the last element, or null if the list is empty.
+ */
+static Value listPop(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+
+    if (list->values.count == 0) return NULL_VAL;
+
+    return list->values.values[--list->values.count];
+}
+
+/**
+ * Inserts a value before the given index, which may be the list's length.
+ */
+static Value listInsert(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+    int index;
+
+    if (argCount != 2)
+    {
+        runtimeError(vm, "List.insert() expects an index and a value (%d given).", argCount);
+        return NULL_VAL;
+    }
+
+    if (!indexArgument(vm, "insert", argCount, args, 1, &index)) return NULL_VAL;
+
+    if (index < 0 || index > list->values.count)
+    {
+        runtimeError(vm, "List index out of bounds.");
+        return NULL_VAL;
+    }
+
+    reserve(vm, list, list->values.count + 1);
+
+    Value *values = list->values.values;
+    memmove(values + index + 1, values + index, sizeof(Value) * (list->values.count - index));
+    values[index] = args[2];
+    list->values.count++;
+    writeBarrier(vm, (Obj*)list, args[2]);
+
+    return NULL_VAL;
+}
+
+/**
+ * Removes and returns the element at the given index.
+ */
+static Value listRemove(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+    int index;
+
+    if (!indexArgument(vm, "remove", argCount, args, 1, &index)) return NULL_VAL;
+
+    if (index < 0 || index >= list->values.count)
+    {
+        runtimeError(vm, "List index out of bounds.");
+        return NULL_VAL;
+    }
+
+    Value *values = list->values.values;
+    Value removed = values[index];
+    memmove(values + index, values + index + 1, sizeof(Value) * (list->values.count - index - 1));
+    list->values.count--;
+
+    return removed;
+}
+
+/**
+ * Returns a new list of the elements from the start index up to, but not
+ * including, the end index, which defaults to the length. Negative indexes
+ * count back from the end.
+ */
+static Value listSlice(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+    int count = list->values.count;
+    int start;
+    int end = count;
+
+    if (!indexArgument(vm, "slice", argCount, args, 1, &start)) return NULL_VAL;
+    if (argCount > 1 && !indexArgument(vm, "slice", argCount, args, 2, &end)) return NULL_VAL;
+
+    start = sliceBound(start, count);
+    end = sliceBound(end, count);
+
+    if (end < start) end = start;
+
+    return OBJ_VAL(copyList(vm, list->values.values + start, end - start));
+}
+
+/**
+ * Returns the index of the first element equal to the argument, or -1.
+ */
+static Value listIndexOf(GhostVM *vm, int argCount, Value *args)
+{
+    if (argCount != 1)
+    {
+        runtimeError(vm, "List.indexOf() expects exactly one argument (%d given).", argCount);
+        return NULL_VAL;
+    }
+
+    ObjList *list = AS_LIST(args[0]);
+
+    // Lazy strings only compare equal once flattened. The argument slot and
+    // the list keep them reachable while that happens.
+    if (IS_LAZY_STRING(args[1]))
+    {
+        args[1] = OBJ_VAL(flattenString(vm, AS_LAZY_STRING(args[1])));
+    }
+
+    for (int i = 0; i < list->values.count; i++)
+    {
+        Value element = list->values.values[i];
+
+        if (IS_LAZY_STRING(element))
+        {
+            element = OBJ_VAL(flattenString(vm, AS_LAZY_STRING(element)));
+        }
+
+        if (valuesEqual(element, args[1])) return NUMBER_VAL(i);
+    }
+
+    return NUMBER_VAL(-1);
+}
+
+/**
+ * Reverses the list in place and returns it.
+ */
+static Value listReverse(GhostVM *vm, int argCount, Value *args)
+{
+    ObjList *list = AS_LIST(args[0]);
+    Value *values = list->values.values;
+
+    for (int i = 0, j = list->values.count - 1; i < j; i++, j--)
+    {
+        Value swap = values[i];
+        values[i] = values[j];
+        values[j] = swap;
+    }
+
+    return args[0];
+}
+
+/**
+ * Returns a new list of this list's elements followed by the argument's.
+ */
+static Value listConcat(GhostVM *vm, int argCount, Value *args)
+{
+    if (argCount != 1 || !IS_LIST(args[1]))
+    {
+        runtimeError(vm, "List.concat() expects a list argument.");
+        return NULL_VAL;
+    }
+
+    ObjList *list = AS_LIST(args[0]);
+    ObjList *other = AS_LIST(args[1]);
+    int count = list->values.count;
+
+    ObjList *result = copyList(vm, list->values.values, count);
+    push(vm, OBJ_VAL(result));
+    reserve(vm, result, count + other->values.count);
+    pop(vm);
+
+    for (int i = 0; i < other->values.count; i++)
+    {
+        result->values.values[count + i] = other->values.values[i];
+        writeBarrier(vm, (Obj*)result, other->values.values[i]);
+    }
+
+    result->values.count = count + other->values.count;
+    return OBJ_VAL(result);
+}
+
+/**
+ * Sets every element to the argument and returns the list.
+ */
+static Value listFill(GhostVM *vm, int argCount, Value *args)
 {
-    if (strcmp(method, "length") == 0) {
-        return listLength(vm, argCount);
+    if (argCount != 1)
+    {
+        runtimeError(vm, "List.fill() expects exactly one argument (%d given).", argCount);
+        return NULL_VAL;
     }
-    // } else if (strcmp(method, "toNumber") == 0) {
-    //     return stringToNumber(argCount);
-    // }
 
-    runtimeError(vm, "List has no method %s()", method);
-    return false;
+    ObjList *list = AS_LIST(args[0]);
+
+    for (int i = 0; i < list->values.count; i++)
+    {
+        list->values.values[i] = args[1];
+    }
+
+    writeBarrier(vm, (Obj*)list, args[1]);
+    return args[0];
+}
+
+static bool lessNumbers(SortContext *context, Value a, Value b)
+{
+    return AS_NUMBER(a) < AS_NUMBER(b);
+}
+
+static bool lessStrings(SortContext *context, Value a, Value b)
+{
+    ObjString *left = AS_STRING(a);
+    ObjString *right = AS_STRING(b);
+    int length = left->length < right->length ? left->length : right->length;
+    int order = memcmp(left->chars, right->chars, length);
+
+    return order < 0 || (order == 0 && left->length < right->length);
+}
+
+// Calls the script comparator, which returns a negative number when its first
+// argument sorts before its second.
+static bool lessCallback(SortContext *context, Value a, Value b)
+{
+    GhostVM *vm = context->vm;
+
+    push(vm, context->comparator);
+    push(vm, a);
+    push(vm, b);
+
+    if (!callFromNative(vm, 2))
+    {
+        context->failed = true;
+        return false;
+    }
+
+    Value order = pop(vm);
+
+    if (!IS_NUMBER(order))
+    {
+        runtimeError(vm, "List.sort() comparator must return a number.");
+        context->failed = true;
+        return false;
+    }
+
+    return AS_NUMBER(order) < 0;
+}
+
+// Picks a native comparison for the keys, which must be all numbers or all
+// strings. Lazy strings are flattened; whatever holds the keys keeps them
+// reachable.
+static bool chooseNativeLess(GhostVM *vm, const char *method, SortContext *context, SortEntry *entries, int count)
+{
+    bool numbers = true;
+    bool strings = true;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (IS_LAZY_STRING(entries[i].key))
+        {
+            entries[i].key = OBJ_VAL(flattenString(vm, AS_LAZY_STRING(entries[i].key)));
+        }
+
+        numbers = numbers && IS_NUMBER(entries[i].key);
+        strings = strings && IS_STRING(entries[i].key);
+    }
+
+    if (!numbers && !strings)
+    {
+        runtimeError(vm, "List.%s() can only order numbers or strings without a comparator.", method);
+        return false;
+    }
+
+    context->less = numbers ? lessNumbers : lessStrings;
+    return true;
+}
+
+// Sorts the entries and stores their values back into [list]. The caller has
+// pushed two lists that hold every key and value, since neither the entries
+// nor [list], which a comparator may change, keep them reachable.
+static Value sortInto(GhostVM *vm, SortContext *context, ObjList *list, SortEntry *entries, int count)
+{
+    sortEntries(context, entries, count);
+
+    if (context->failed)
+    {
+        // The error has already unwound the stack.
+        FREE_ARRAY(vm, SortEntry, entries, count);
+        return NULL_VAL;
+    }
+
+    reserve(vm, list, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        list->values.values[i] = entries[i].value;
+        writeBarrier(vm, (Obj*)list, entries[i].value);
+    }
+
+    list->values.count = count;
+
+    FREE_ARRAY(vm, SortEntry, entries, count);
+    pop(vm);
+    pop(vm);
+    return OBJ_VAL(list);
+}
+
+/**
+ * Sorts the list in place and returns it. Without an argument, the elements
+ * must be all numbers or all strings. Otherwise the argument is called with
+ * two elements, and returns a negative number if the first goes first, a
+ * positive one if the second does, or zero.
+ */
+static Value listSort(GhostVM *vm, int argCount, Value *args)
+{
+    if (argCount > 1)
+    {
+        runtimeError(vm, "List.sort() takes 0 or 1 arguments (%d given).", argCount);
+        return NULL_VAL;
+    }
+
+    ObjList *list = AS_LIST(args[0]);
+    int count = list->values.count;
+
+    // The values are the keys, so the second list is the same one.
+    ObjList *items = copyList(vm, list->values.values, count);
+    push(vm, OBJ_VAL(items));
+    push(vm, OBJ_VAL(items));
+
+    SortEntry *entries = ALLOCATE(vm, SortEntry, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        entries[i].key = items->values.values[i];
+        entries[i].value = items->values.values[i];
+    }
+
+    SortContext context = { vm, NULL, NULL_VAL, false };
+
+    if (argCount == 1)
+    {
+        context.less = lessCallback;
+        context.comparator = args[1];
+    }
+    else if (!chooseNativeLess(vm, "sort", &context, entries, count))
+    {
+        FREE_ARRAY(vm, SortEntry, entries, count);
+        return NULL_VAL;
+    }
+
+    return sortInto(vm, &context, list, entries, count);
+}
+
+/**
+ * Sorts the list in place by the key the argument returns for each element,
+ * and returns it. The keys are computed once per element up front, and must
+ * be all numbers or all strings.
+ */
+static Value listSortBy(GhostVM *vm, int argCount, Value *args)
+{
+    if (argCount != 1)
+    {
+        runtimeError(vm, "List.sortBy() expects a key function (%d arguments given).", argCount);
+        return NULL_VAL;
+    }
+
+    ObjList *list = AS_LIST(args[0]);
+    int count = list->values.count;
+
+    // Calling the key function may move the stack, and [args] with it.
+    Value keyFunction = args[1];
+
+    ObjList *items = copyList(vm, list->values.values, count);
+    push(vm, OBJ_VAL(items));
+
+    ObjList *keys = newList(vm);
+    push(vm, OBJ_VAL(keys));
+    reserve(vm, keys, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        push(vm, keyFunction);
+        push(vm, items->values.values[i]);
+
+        if (!callFromNative(vm, 1)) return NULL_VAL;
+
+        keys->values.values[keys->values.count++] = vm->stackTop[-1];
+        writeBarrier(vm, (Obj*)keys, vm->stackTop[-1]);
+        pop(vm);
+    }
+
+    SortEntry *entries = ALLOCATE(vm, SortEntry, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        entries[i].key = keys->values.values[i];
+        entries[i].value = items->values.values[i];
+    }
+
+    SortContext context = { vm, NULL, NULL_VAL, false };
+
+    if (!chooseNativeLess(vm, "sortBy", &context, entries, count))
+    {
+        FREE_ARRAY(vm, SortEntry, entries, count);
+        return NULL_VAL;
+    }
+
+    return sortInto(vm, &context, list, entries, count);
+}
+
+/**
+ * Makes room for at least the given number of elements, so pushing up to
+ * that many does not reallocate.
+ */
+static Value listReserve(GhostVM *vm, int argCount, Value *args)
+{
+    int capacity;
+
+    if (!indexArgument(vm, "reserve", argCount, args, 1, &capacity)) return NULL_VAL;
+
+    reserve(vm, AS_LIST(args[0]), capacity);
+    return NULL_VAL;
+}
+
+void registerListMethods(GhostVM *vm)
+{
+    ObjString *name = externalString(vm, "List", 4);
+    push(vm, OBJ_VAL(name));
+    vm->listClass = newNativeClass(vm, name);
+
+    defineNativeMethod(vm, vm->listClass, "length", listLength);
+    defineNativeMethod(vm, vm->listClass, "push", listPush);
+    defineNativeMethod(vm, vm->listClass, "pop", listPop);
+    defineNativeMethod(vm, vm->listClass, "insert", listInsert);
+    defineNativeMethod(vm, vm->listClass, "remove", listRemove);
+    defineNativeMethod(vm, vm->listClass, "slice", listSlice);
+    defineNativeMethod(vm, vm->listClass, "indexOf", listIndexOf);
+    defineNativeMethod(vm, vm->listClass, "reverse", listReverse);
+    defineNativeMethod(vm, vm->listClass, "concat", listConcat);
+    defineNativeMethod(vm, vm->listClass, "fill", listFill);
+    defineNativeMethod(vm, vm->listClass, "reserve", listReserve);
+    defineNativeMethod(vm, vm->listClass, "sort", listSort);
+    defineNativeMethod(vm, vm->listClass, "sortBy", listSortBy);
+
+    pop(vm);
 }
\ No newline at end of file
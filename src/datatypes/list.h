@@ -6,6 +6,6 @@
 
 #include "../include/ghost.h"
 
-bool declareList(GhostVM *vm, char *method, int argCount);
+void registerListMethods(GhostVM *vm);
 
 #endif
\ No newline at end of file
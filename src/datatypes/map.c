@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/ghost.h"
+#include "map.h"
+#include "../memory.h"
+#include "../modules/modules.h"
+#include "../vm.h"
+
+// Maps use Robin Hood open addressing. Each entry records how far it was
+// pushed from its home slot, and an insertion takes the slot of any entry
+// that sits closer to home than the new key would, then carries on with the
+// displaced entry. That keeps every run of keys ordered by home slot, so a
+// lookup can stop as soon as it meets an entry nearer home than itself, and
+// deleting shifts the rest of the run back instead of leaving a tombstone.
+
+// The table grows before it is more than 7/8 full.
+#define MAP_MAX_LOAD_NUMERATOR 7
+#define MAP_MAX_LOAD_DENOMINATOR 8
+
+// Scrambles [bits] so that keys differing only in their high bits, like
+// nearby numbers or neighbouring objects, still land in different slots.
+static uint32_t mixBits(uint64_t bits)
+{
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+
+    return (uint32_t)bits;
+}
+
+static uint32_t hashKey(Value key)
+{
+    if (IS_STRING(key)) return AS_STRING(key)->hash;
+
+    if (IS_NUMBER(key))
+    {
+        // 0 and -0 are equal, so they must hash alike.
+        double number = AS_NUMBER(key);
+        if (number == 0) number = 0;
+
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return mixBits(bits);
+    }
+
+#if NAN_BOXING
+    return mixBits(key);
+#else
+    if (IS_OBJ(key)) return mixBits((uint64_t)(uintptr_t)AS_OBJ(key));
+    if (IS_BOOL(key)) return AS_BOOL(key) ? 3 : 2;
+    return 1;
+#endif
+}
+
+// Returns the index of the entry holding [key], or -1.
+static int findEntry(ObjMap *map, Value key, uint32_t hash)
+{
+    if (map->count == 0) return -1;
+
+    uint32_t mask = map->capacity - 1;
+    uint32_t index = hash & mask;
+
+    for (uint32_t distance = 1;; distance++)
+    {
+        MapEntry *entry = &map->entries[index];
+
+        // Any entry closer to home than [key] would be means [key] is absent.
+        // Empty slots have a distance of zero, so they stop the search too.
+        if (entry->distance < distance) return -1;
+
+        if (entry->hash == hash && valuesEqual(entry->key, key)) return index;
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Places a key known not to be in [entries] yet.
+static void insertEntry(MapEntry *entries, uint32_t mask, Value key, Value value, uint32_t hash)
+{
+    MapEntry entry = {key, value, hash, 1};
+    uint32_t index = hash & mask;
+
+    for (;;)
+    {
+        MapEntry *slot = &entries[index];
+
+        if (slot->distance == 0)
+        {
+            *slot = entry;
+            return;
+        }
+
+        if (slot->distance < entry.distance)
+        {
+            MapEntry displaced = *slot;
+            *slot = entry;
+            entry = displaced;
+        }
+
+        entry.distance++;
+        index = (index + 1) & mask;
+    }
+}
+
+static void growMap(GhostVM *vm, ObjMap *map)
+{
+    int capacity = GROW_CAPACITY(map->capacity);
+    MapEntry *entries = ALLOCATE(vm, MapEntry, capacity);
+
+    for (int i = 0; i < capacity; i++)
+    {
+        entries[i].distance = 0;
+    }
+
+    for (int i = 0; i < map->capacity; i++)
+    {
+        MapEntry *entry = &map->entries[i];
+        if (entry->distance == 0) continue;
+
+        insertEntry(entries, capacity - 1, entry->key, entry->value, entry->hash);
+    }
+
+    FREE_ARRAY(vm, MapEntry, map->entries, map->capacity);
+    map->entries = entries;
+    map->capacity = capacity;
+}
+
+bool mapGet(ObjMap *map, Value key, Value *value)
+{
+    int index = findEntry(map, key, hashKey(key));
+    if (index == -1) return false;
+
+    *value = map->entries[index].value;
+    return true;
+}
+
+// Stores [value] under [key], returning true if the key is new. The caller
+// keeps [map], [key] and [value] reachable, since the table may grow.
+bool mapSet(GhostVM *vm, ObjMap *map, Value key, Value value)
+{
+    uint32_t hash = hashKey(key);
+    int index = findEntry(map, key, hash);
+
+    if (index != -1)
+    {
+        map->entries[index].value = value;
+        writeBarrier(vm, (Obj*)map, value);
+        return false;
+    }
+
+    if ((map->count + 1) * MAP_MAX_LOAD_DENOMINATOR > map->capacity * MAP_MAX_LOAD_NUMERATOR)
+    {
+        growMap(vm, map);
+    }
+
+    insertEntry(map->entries, map->capacity - 1, key, value, hash);
+    map->count++;
+
+    writeBarrier(vm, (Obj*)map, key);
+    writeBarrier(vm, (Obj*)map, value);
+    return true;
+}
+
+bool mapDelete(ObjMap *map, Value key)
+{
+    int found = findEntry(map, key, hashKey(key));
+    if (found == -1) return false;
+
+    // Shift the rest of the run back one slot, stopping at an empty slot or
+    // an entry already at home.
+    uint32_t mask = map->capacity - 1;
+    uint32_t index = found;
+
+    for (;;)
+    {
+        uint32_t next = (index + 1) & mask;
+        MapEntry *entry = &map->entries[next];
+
+        if (entry->distance <= 1) break;
+
+        map->entries[index] = *entry;
+        map->entries[index].distance--;
+        index = next;
+    }
+
+    map->entries[index].distance = 0;
+    map->count--;
+    return true;
+}
+
+// Map methods are natives that receive the map in args[0], followed by their
+// [argCount] arguments.
+
+// Checks that [method] was given a key, and flattens it if it is a lazy
+// string. The argument slot keeps it reachable while that happens.
+static bool keyArgument(GhostVM *vm, const char *method, int argCount, Value *args)
+{
+    if (argCount < 1)
+    {
+        runtimeError(vm, "Map.%s() expects a key.", method);
+        return false;
+    }
+
+    if (IS_LAZY_STRING(args[1]))
+    {
+        args[1] = OBJ_VAL(flattenString(vm, AS_LAZY_STRING(args[1])));
+    }
+
+    return true;
+}
+
+// Collects the keys or the values of [map] into a new list.
+static Value collect(GhostVM *vm, ObjMap *map, bool keys)
+{
+    ObjList *list = newList(vm);
+    push(vm, OBJ_VAL(list));
+
+    for (int i = 0; i < map->capacity; i++)
+    {
+        MapEntry *entry = &map->entries[i];
+        if (entry->distance == 0) continue;
+
+        Value value = keys ? entry->key : entry->value;
+        writeValueArray(vm, &list->values, value);
+        writeBarrier(vm, (Obj*)list, value);
+    }
+
+    pop(vm);
+    return OBJ_VAL(list);
+}
+
+static Value mapLength(GhostVM *vm, int argCount, Value *args)
+{
+    return NUMBER_VAL(AS_MAP(args[0])->count);
+}
+
+/**
+ * Returns whether the map has an entry for the given key.
+ */
+static Value mapHas(GhostVM *vm, int argCount, Value *args)
+{
+    if (!keyArgument(vm, "has", argCount, args)) return NULL_VAL;
+
+    Value value;
+    return BOOL_VAL(mapGet(AS_MAP(args[0]), args[1], &value));
+}
+
+/**
+ * Returns the value stored under the given key, or the second argument (null
+ * if omitted) when there is none. Counting is written as
+ * counts[key] = counts.get(key, 0) + 1.
+ */
+static Value mapGetMethod(GhostVM *vm, int argCount, Value *args)
+{
+    if (!keyArgument(vm, "get", argCount, args)) return NULL_VAL;
+
+    Value value;
+    if (mapGet(AS_MAP(args[0]), args[1], &value)) return value;
+
+    return argCount > 1 ? args[2] : NULL_VAL;
+}
+
+/**
+ * Deletes the entry for the given key, returning whether there was one.
+ */
+static Value mapRemove(GhostVM *vm, int argCount, Value *args)
+{
+    if (!keyArgument(vm, "remove", argCount, args)) return NULL_VAL;
+
+    return BOOL_VAL(mapDelete(AS_MAP(args[0]), args[1]));
+}
+
+/**
+ * Returns a list of the map's keys, in no particular order.
+ */
+static Value mapKeys(GhostVM *vm, int argCount, Value *args)
+{
+    return collect(vm, AS_MAP(args[0]), true);
+}
+
+/**
+ * Returns a list of the map's values, in the same order as keys().
+ */
+static Value mapValues(GhostVM *vm, int argCount, Value *args)
+{
+    return collect(vm, AS_MAP(args[0]), false);
+}
+
+/**
+ * Deletes every entry, keeping the table's capacity.
+ */
+static Value mapClear(GhostVM *vm, int argCount, Value *args)
+{
+    ObjMap *map = AS_MAP(args[0]);
+
+    for (int i = 0; i < map->capacity; i++)
+    {
+        map->entries[i].distance = 0;
+    }
+
+    map->count = 0;
+    return NULL_VAL;
+}
+
+void registerMapMethods(GhostVM *vm)
+{
+    ObjString *name = externalString(vm, "Map", 3);
+    push(vm, OBJ_VAL(name));
+    vm->mapClass = newNativeClass(vm, name);
+
+    defineNativeMethod(vm, vm->mapClass, "length", mapLength);
+    defineNativeMethod(vm, vm->mapClass, "has", mapHas);
+    defineNativeMethod(vm, vm->mapClass, "get", mapGetMethod);
+    defineNativeMethod(vm, vm->mapClass, "remove", mapRemove);
+    defineNativeMethod(vm, vm->mapClass, "keys", mapKeys);
+    defineNativeMethod(vm, vm->mapClass, "values", mapValues);
+    defineNativeMethod(vm, vm->mapClass, "clear", mapClear);
+
+    pop(vm);
+}
\ No newline at end of file
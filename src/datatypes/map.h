@@ -0,0 +1,17 @@
+#ifndef ghost_map_h
+#define ghost_map_h
+
+#include <stdbool.h>
+
+#include "../include/ghost.h"
+#include "../object.h"
+
+// Keys must not be lazy strings: flatten them first, so that equal strings
+// are the same object.
+bool mapGet(ObjMap *map, Value key, Value *value);
+bool mapSet(GhostVM *vm, ObjMap *map, Value key, Value value);
+bool mapDelete(ObjMap *map, Value key);
+
+void registerMapMethods(GhostVM *vm);
+
+#endif
\ No newline at end of file
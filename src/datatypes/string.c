@@ -7,18 +7,18 @@
 
 bool static stringLowerCase(GhostVM *vm, int argCount)
 {
-    ObjString *string = AS_STRING(pop(vm));
-
-    char *temp = malloc(sizeof(char) * (string->length + 1));
+    // Leave the string on the stack while allocating the copy.
+    ObjString *string = AS_STRING(vm->stackTop[-1]);
+    ObjString *result = newString(vm, string->length);
 
-    for (int i = 0; string->chars[i]; i++)
+    for (int i = 0; i < string->length; i++)
     {
-        temp[i] = tolower(string->chars[i]);
+        result->chars[i] = tolower(string->chars[i]);
     }
 
-    temp[string->length] = '\0';
-
-    push(vm, OBJ_VAL(copyString(vm, temp, string->length)));
+    result = internString(vm, result);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
     return true;
 }
 
@@ -35,18 +35,18 @@ bool static stringToNumber(GhostVM *vm, int argCount)
 
 bool static stringUpperCase(GhostVM *vm, int argCount)
 {
-    ObjString *string = AS_STRING(pop(vm));
-
-    char *temp = malloc(sizeof(char) * (string->length + 1));
+    // Leave the string on the stack while allocating the copy.
+    ObjString *string = AS_STRING(vm->stackTop[-1]);
+    ObjString *result = newString(vm, string->length);
 
-    for (int i = 0; string->chars[i]; i++)
+    for (int i = 0; i < string->length; i++)
     {
-        temp[i] = toupper(string->chars[i]);
+        result->chars[i] = toupper(string->chars[i]);
     }
 
-    temp[string->length] = '\0';
-
-    push(vm, OBJ_VAL(copyString(vm, temp, string->length)));
+    result = internString(vm, result);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
     return true;
 }
 
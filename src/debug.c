@@ -12,8 +12,32 @@ void disassembleChunk(Chunk* chunk, const char* name) {
     }
 }
 
+// Reads the constant index that follows the instruction at [offset] and moves
+// [offset] past it. The wide (_LONG) instructions take three bytes for it.
+static int readConstantOperand(Chunk* chunk, int* offset) {
+    uint8_t* operand = &chunk->code[*offset + 1];
+
+    switch (chunk->code[*offset]) {
+        case OP_CONSTANT_LONG:
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+        case OP_GET_SUPER_LONG:
+        case OP_INVOKE_LONG:
+        case OP_SUPER_INVOKE_LONG:
+        case OP_CLOSURE_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+            *offset += 4;
+            return (operand[0] << 16) | (operand[1] << 8) | operand[2];
+
+        default:
+            *offset += 2;
+            return operand[0];
+    }
+}
+
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
-    uint8_t constant = chunk->code[offset + 1];
+    int constant = readConstantOperand(chunk, &offset);
 
     printf("%-16s %4d '", name, constant);
 
@@ -21,16 +45,37 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
 
     printf("'\n");
 
-    return offset + 2;
+    return offset;
 }
 
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 2];
+    int constant = readConstantOperand(chunk, &offset);
+    uint8_t argCount = chunk->code[offset];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
 
+    return offset + 1;
+}
+
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+    int constant = readConstantOperand(chunk, &offset);
+    uint16_t cache = (uint16_t)(chunk->code[offset] << 8) | chunk->code[offset + 1];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' (cache %d)\n", cache);
+
+    return offset + 2;
+}
+
+static int invokeCacheInstruction(const char* name, Chunk* chunk, int offset) {
+    int constant = readConstantOperand(chunk, &offset);
+    uint8_t argCount = chunk->code[offset];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s (%d args) %4d '", name, argCount, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' (cache %d)\n", cache);
+
     return offset + 3;
 }
 
@@ -47,6 +92,40 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+static int twoByteInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+
+    return offset + 3;
+}
+
+static int localConstantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+
+    return offset + 3;
+}
+
+static int localConstantJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' -> %d\n", offset + 5 + jump);
+
+    return offset + 5;
+}
+
+static int shortInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d\n", name, slot);
+
+    return offset + 3;
+}
+
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
     uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
     jump |= chunk->code[offset + 2];
@@ -83,19 +162,19 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return shortInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return shortInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return shortInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
         case OP_GET_PROPERTY:
-            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
         case OP_SET_PROPERTY:
-            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
         case OP_GET_SUPER:
             return constantInstruction("OP_GET_SUPER", chunk, offset);
         case OP_EQUAL:
@@ -104,6 +183,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_GREATER", offset);
         case OP_LESS:
             return simpleInstruction("OP_LESS", offset);
+        case OP_NOT_EQUAL:
+            return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OP_GREATER_EQUAL:
+            return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case OP_LESS_EQUAL:
+            return simpleInstruction("OP_LESS_EQUAL", offset);
         case OP_ADD:
             return simpleInstruction("OP_ADD", offset);
         case OP_SUBTRACT:
@@ -122,29 +207,35 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_JUMP_IF_FALSE:
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_INVOKE:
-            return invokeInstruction("OP_INVOKE", chunk, offset);
+            return invokeCacheInstruction("OP_INVOKE", chunk, offset);
         case OP_SUPER_INVOKE:
             return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
 
-        case OP_CLOSURE: {
-            offset++;
-            uint8_t constant = chunk->code[offset++];
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG: {
+            const char* name = instruction == OP_CLOSURE ? "OP_CLOSURE" : "OP_CLOSURE_LONG";
+            int constant = readConstantOperand(chunk, &offset);
+            printf("%-16s %4d ", name, constant);
             printValue(chunk->constants.values[constant]);
             printf("\n");
 
             ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
 
             for (int j = 0; j < function->upvalueCount; j++) {
-                int isLocal = chunk->code[offset++];
-                int index = chunk->code[offset++];
+                int isLocal = chunk->code[offset];
+                int index = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+                offset += 3;
 
-                printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+                printf("%04d      |                     %s %d\n", offset - 3, isLocal ? "local" : "upvalue", index);
             }
 
             return offset;
@@ -162,10 +253,66 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return constantInstruction("OP_METHOD", chunk, offset);
         case OP_INCLUDE:
             return simpleInstruction("OP_INCLUDE", offset);
+        case OP_IMPORT:
+            return simpleInstruction("OP_IMPORT", offset);
+        case OP_GET_LOCAL_GET_LOCAL:
+            return twoByteInstruction("OP_GET_LOCAL_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+        case OP_ADD_LOCAL_CONST:
+            return localConstantInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+        case OP_SUBTRACT_LOCAL_CONST:
+            return localConstantInstruction("OP_SUBTRACT_LOCAL_CONST", chunk, offset);
+        case OP_LESS_LOCAL_CONST_JUMP:
+            return localConstantJumpInstruction("OP_LESS_LOCAL_CONST_JUMP", chunk, offset);
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            return localConstantJumpInstruction("OP_GREATER_LOCAL_CONST_JUMP", chunk, offset);
+        case OP_RETURN_LOCAL:
+            return byteInstruction("OP_RETURN_LOCAL", chunk, offset);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_SUBTRACT_NUM:
+            return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:
+            return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case OP_DIVIDE_NUM:
+            return simpleInstruction("OP_DIVIDE_NUM", offset);
+        case OP_GREATER_NUM:
+            return simpleInstruction("OP_GREATER_NUM", offset);
+        case OP_LESS_NUM:
+            return simpleInstruction("OP_LESS_NUM", offset);
+        case OP_GREATER_EQUAL_NUM:
+            return simpleInstruction("OP_GREATER_EQUAL_NUM", offset);
+        case OP_LESS_EQUAL_NUM:
+            return simpleInstruction("OP_LESS_EQUAL_NUM", offset);
+        case OP_CONSTANT_LONG:
+            return constantInstruction("OP_CONSTANT_LONG", chunk, offset);
+        case OP_GET_LOCAL_LONG:
+            return shortInstruction("OP_GET_LOCAL_LONG", chunk, offset);
+        case OP_SET_LOCAL_LONG:
+            return shortInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+        case OP_GET_PROPERTY_LONG:
+            return propertyInstruction("OP_GET_PROPERTY_LONG", chunk, offset);
+        case OP_SET_PROPERTY_LONG:
+            return propertyInstruction("OP_SET_PROPERTY_LONG", chunk, offset);
+        case OP_GET_SUPER_LONG:
+            return constantInstruction("OP_GET_SUPER_LONG", chunk, offset);
+        case OP_INVOKE_LONG:
+            return invokeCacheInstruction("OP_INVOKE_LONG", chunk, offset);
+        case OP_SUPER_INVOKE_LONG:
+            return invokeInstruction("OP_SUPER_INVOKE_LONG", chunk, offset);
+        case OP_CLASS_LONG:
+            return constantInstruction("OP_CLASS_LONG", chunk, offset);
+        case OP_METHOD_LONG:
+            return constantInstruction("OP_METHOD_LONG", chunk, offset);
         case OP_NEW_LIST:
             return simpleInstruction("OP_NEW_LIST", offset);
         case OP_ADD_LIST:
             return simpleInstruction("OP_ADD_LIST", offset);
+        case OP_NEW_MAP:
+            return simpleInstruction("OP_NEW_MAP", offset);
+        case OP_ADD_MAP:
+            return simpleInstruction("OP_ADD_MAP", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -1,8 +1,13 @@
 #ifndef ghost_h
 #define ghost_h
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+// The version of the Ghost VM. Cached bytecode is only reused by the version
+// that wrote it.
+#define GHOST_VERSION "dev-master"
+
 typedef struct GhostVM GhostVM;
 
 // A generic allocation that handles all explicit memory management used by
@@ -22,10 +27,59 @@ typedef struct GhostVM GhostVM;
 // - To free memory, [newSize] will be zero.
 typedef void *(*GhostReallocateFn)(void *memory, size_t oldSize, size_t newSize);
 
-// Create a new Ghost virtual machine. It allocates memory for the VM itself
-// using [reallocateFn] and then uses that throughout its lifetime to manage
-// memory.
-GhostVM* ghostNewVM(GhostReallocateFn reallocateFn);
+// The garbage collection strategies a VM can be created with.
+typedef enum {
+    // Every collection marks and sweeps the whole heap.
+    GHOST_GC_MARK_SWEEP,
+
+    // New objects start out in a nursery that is collected on its own, and
+    // often, while the rest of the heap is only collected once it has grown.
+    // Most objects die young, so this keeps the typical pause short.
+    GHOST_GC_GENERATIONAL
+} GhostCollector;
+
+typedef struct {
+    // The callback Ghost will use to allocate memory for the VM itself.
+    GhostReallocateFn reallocateFn;
+
+    // Which garbage collector the VM uses.
+    GhostCollector collector;
+
+    // With the generational collector, the number of bytes that may be
+    // allocated before the nursery is collected.
+    size_t nurserySize;
+
+    // The most objects a collection of the whole heap may mark, clear or
+    // sweep in one step. Steps are interleaved with allocation, so pauses do
+    // not grow with the heap. Marking also rescans the stack and the global
+    // variables whenever it runs out of objects, though, so a pause can take
+    // as long as that does. Zero collects the whole heap in a single pause
+    // instead.
+    size_t gcStepSize;
+
+    // Whether files run with [ghostInterpretFile] or pulled in by `include`
+    // keep their compiled bytecode in a ".ghostc" file next to the source,
+    // so later runs can skip compiling them.
+    bool cacheBytecode;
+
+    // The deepest calls may nest before the VM reports a stack overflow.
+    int maxCallDepth;
+
+    // How many calls and loop iterations it takes for a function to be
+    // compiled to machine code, on platforms the JIT supports. Zero keeps
+    // everything interpreted.
+    int jitThreshold;
+} GhostConfiguration;
+
+// Initializes [configuration] with all of its default values.
+//
+// Call this before setting the particular fields you care about.
+void ghostInitConfiguration(GhostConfiguration* configuration);
+
+// Create a new Ghost virtual machine using the given [configuration]. It
+// allocates memory for the VM itself using its [reallocateFn] and then uses
+// that throughout its lifetime to manage memory.
+GhostVM* ghostNewVM(GhostConfiguration* configuration);
 
 // Disposes of all resources to use by [vm], which was previously created by a
 // call to [ghostNewVM].
@@ -43,4 +97,8 @@ typedef enum {
 // sucessful.
 InterpretResult ghostInterpret(GhostVM *vm, const char *source);
 
+// Runs the Ghost source file at [path] in [vm], reusing its cached bytecode
+// when the configuration allows it and the file has not changed.
+InterpretResult ghostInterpretFile(GhostVM *vm, const char *path);
+
 #endif
\ No newline at end of file
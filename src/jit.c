@@ -0,0 +1,783 @@
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "memory.h"
+
+#if JIT_COMPILER
+
+// The machine code keeps the hottest state of the VM in callee-saved
+// registers, so that it survives calls out to C:
+//
+// - rbx holds the top of the value stack, like stackTop in run().
+// - r12 holds the slots of the frame.
+// - r13 holds the JitContext the code was entered with.
+// - r14 holds the constant table of the function.
+// - r15 holds the VM.
+//
+// rax, rcx, rdx, rsi, rdi, xmm0 and xmm1 are scratch.
+typedef enum {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15
+} Register;
+
+typedef enum {
+    XMM0 = 0,
+    XMM1 = 1
+} XmmRegister;
+
+// The condition codes of jcc and setcc.
+typedef enum {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7
+} Condition;
+
+// The two-operand integer instructions, by their "op r/m64, r64" opcode.
+typedef enum {
+    ALU_ADD = 0x01,
+    ALU_AND = 0x21,
+    ALU_XOR = 0x31,
+    ALU_CMP = 0x39,
+    ALU_MOV = 0x89
+} AluOp;
+
+// What the machine code loads its registers from when it is entered, and
+// where it leaves the stack top and the next instruction for the
+// interpreter when it exits.
+typedef struct {
+    Value* stackTop;
+    Value* slots;
+    Value* constants;
+    ObjUpvalue** upvalues;
+    GhostVM* vm;
+    uint8_t* ip;
+} JitContext;
+
+// The prologue at the start of every function's machine code, which jumps
+// to [entry] once the registers are set up.
+typedef void (*JitEnterFn)(JitContext* context, uint8_t* entry);
+
+typedef struct {
+    // Where the 32-bit displacement to patch starts.
+    int position;
+    int label;
+} Fixup;
+
+typedef struct {
+    int label;
+    int offset;
+} SideExit;
+
+typedef struct {
+    GhostVM *vm;
+    Chunk* chunk;
+
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    // The position each label is bound to, or -1 before it is. The first
+    // [chunk->count] labels stand for the instruction at that bytecode
+    // offset.
+    int* labels;
+    int labelCount;
+    int labelCapacity;
+
+    // Jumps to labels that may not be bound yet.
+    Fixup* fixups;
+    int fixupCount;
+    int fixupCapacity;
+
+    // Slow paths that hand an instruction over to the interpreter, emitted
+    // after the instructions so the fast paths stay together.
+    SideExit* sideExits;
+    int sideExitCount;
+    int sideExitCapacity;
+
+    // The code every exit to the interpreter ends in.
+    int exitLabel;
+} Assembler;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(as->vm, as->code, uint8_t, oldCapacity, as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, uint8_t byte1, uint8_t byte2) {
+    emitByte(as, byte1);
+    emitByte(as, byte2);
+}
+
+static void emitInt32(Assembler* as, int32_t value) {
+    uint32_t bits = (uint32_t)value;
+    for (int i = 0; i < 4; i++) emitByte(as, (bits >> (i * 8)) & 0xff);
+}
+
+static void emitInt64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte(as, (value >> (i * 8)) & 0xff);
+}
+
+static int newLabel(Assembler* as) {
+    if (as->labelCapacity < as->labelCount + 1) {
+        int oldCapacity = as->labelCapacity;
+        as->labelCapacity = GROW_CAPACITY(oldCapacity);
+        as->labels = GROW_ARRAY(as->vm, as->labels, int, oldCapacity, as->labelCapacity);
+    }
+
+    as->labels[as->labelCount] = -1;
+
+    return as->labelCount++;
+}
+
+static void bindLabel(Assembler* as, int label) {
+    as->labels[label] = as->count;
+}
+
+static void emitLabelReference(Assembler* as, int label) {
+    if (as->fixupCapacity < as->fixupCount + 1) {
+        int oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = GROW_CAPACITY(oldCapacity);
+        as->fixups = GROW_ARRAY(as->vm, as->fixups, Fixup, oldCapacity, as->fixupCapacity);
+    }
+
+    as->fixups[as->fixupCount].position = as->count;
+    as->fixups[as->fixupCount].label = label;
+    as->fixupCount++;
+
+    emitInt32(as, 0);
+}
+
+// Returns a label for code that leaves the instruction at bytecode [offset]
+// to the interpreter.
+static int sideExit(Assembler* as, int offset) {
+    if (as->sideExitCapacity < as->sideExitCount + 1) {
+        int oldCapacity = as->sideExitCapacity;
+        as->sideExitCapacity = GROW_CAPACITY(oldCapacity);
+        as->sideExits = GROW_ARRAY(as->vm, as->sideExits, SideExit, oldCapacity, as->sideExitCapacity);
+    }
+
+    int label = newLabel(as);
+    as->sideExits[as->sideExitCount].label = label;
+    as->sideExits[as->sideExitCount].offset = offset;
+    as->sideExitCount++;
+
+    return label;
+}
+
+// Instruction encoding. Only the forms the templates below need are here,
+// always with 64-bit operands and 32-bit displacements.
+
+static void emitRex(Assembler* as, int reg, int rm) {
+    emitByte(as, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+static void emitMemoryOperand(Assembler* as, int reg, Register base, int32_t displacement) {
+    emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+
+    // rsp and r12 can only be used as a base through a SIB byte.
+    if ((base & 7) == RSP) emitByte(as, 0x24);
+
+    emitInt32(as, displacement);
+}
+
+static void emitLoad(Assembler* as, Register destination, Register base, int32_t displacement) {
+    emitRex(as, destination, base);
+    emitByte(as, 0x8b);
+    emitMemoryOperand(as, destination, base, displacement);
+}
+
+static void emitStore(Assembler* as, Register base, int32_t displacement, Register source) {
+    emitRex(as, source, base);
+    emitByte(as, 0x89);
+    emitMemoryOperand(as, source, base, displacement);
+}
+
+static void emitMoveImmediate(Assembler* as, Register destination, uint64_t value) {
+    emitRex(as, 0, destination);
+    emitByte(as, 0xb8 | (destination & 7));
+    emitInt64(as, value);
+}
+
+static void emitAlu(Assembler* as, AluOp op, Register destination, Register source) {
+    emitRex(as, source, destination);
+    emitBytes(as, op, 0xc0 | ((source & 7) << 3) | (destination & 7));
+}
+
+static void emitAddImmediate(Assembler* as, Register destination, int32_t value) {
+    emitRex(as, 0, destination);
+    emitBytes(as, 0x81, 0xc0 | (destination & 7));
+    emitInt32(as, value);
+}
+
+static void emitMoveToXmm(Assembler* as, XmmRegister destination, Register source) {
+    emitByte(as, 0x66);
+    emitRex(as, destination, source);
+    emitBytes(as, 0x0f, 0x6e);
+    emitByte(as, 0xc0 | (destination << 3) | (source & 7));
+}
+
+static void emitMoveFromXmm(Assembler* as, Register destination, XmmRegister source) {
+    emitByte(as, 0x66);
+    emitRex(as, source, destination);
+    emitBytes(as, 0x0f, 0x7e);
+    emitByte(as, 0xc0 | (source << 3) | (destination & 7));
+}
+
+// Emits one of the scalar double instructions: addsd, subsd, mulsd and divsd
+// with [prefix] 0xf2, and ucomisd with 0x66.
+static void emitSse(Assembler* as, uint8_t prefix, uint8_t op, XmmRegister destination, XmmRegister source) {
+    emitBytes(as, prefix, 0x0f);
+    emitBytes(as, op, 0xc0 | (destination << 3) | source);
+}
+
+// Sets the low byte of [destination], which must be one of rax, rcx and
+// rdx, to whether [condition] holds.
+static void emitSetCondition(Assembler* as, Condition condition, Register destination) {
+    emitBytes(as, 0x0f, 0x90 | condition);
+    emitByte(as, 0xc0 | destination);
+}
+
+static void emitJump(Assembler* as, int label) {
+    emitByte(as, 0xe9);
+    emitLabelReference(as, label);
+}
+
+static void emitJumpIf(Assembler* as, Condition condition, int label) {
+    emitBytes(as, 0x0f, 0x80 | condition);
+    emitLabelReference(as, label);
+}
+
+static void emitCall(Assembler* as, void* function) {
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)function);
+    emitBytes(as, 0xff, 0xd0);
+}
+
+// Saves the callee-saved registers, loads the VM state from the context in
+// rdi and jumps to the entry point in rsi. Five pushes on top of the return
+// address leave the stack 16-byte aligned for calls out to C.
+static void emitPrologue(Assembler* as) {
+    emitByte(as, 0x53);
+    emitBytes(as, 0x41, 0x54);
+    emitBytes(as, 0x41, 0x55);
+    emitBytes(as, 0x41, 0x56);
+    emitBytes(as, 0x41, 0x57);
+
+    emitAlu(as, ALU_MOV, R13, RDI);
+    emitLoad(as, RBX, R13, offsetof(JitContext, stackTop));
+    emitLoad(as, R12, R13, offsetof(JitContext, slots));
+    emitLoad(as, R14, R13, offsetof(JitContext, constants));
+    emitLoad(as, R15, R13, offsetof(JitContext, vm));
+
+    emitBytes(as, 0xff, 0xe6);
+}
+
+// Hands the instruction whose address is in rax to the interpreter.
+static void emitEpilogue(Assembler* as) {
+    emitStore(as, R13, offsetof(JitContext, ip), RAX);
+    emitStore(as, R13, offsetof(JitContext, stackTop), RBX);
+
+    emitBytes(as, 0x41, 0x5f);
+    emitBytes(as, 0x41, 0x5e);
+    emitBytes(as, 0x41, 0x5d);
+    emitBytes(as, 0x41, 0x5c);
+    emitByte(as, 0x5b);
+    emitByte(as, 0xc3);
+}
+
+static void emitExit(Assembler* as, int offset) {
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + offset));
+    emitJump(as, as->exitLabel);
+}
+
+// Templates shared by several instructions.
+
+static void emitPushValue(Assembler* as, Register value) {
+    emitStore(as, RBX, 0, value);
+    emitAddImmediate(as, RBX, sizeof(Value));
+}
+
+// Jumps to [label] unless [value] holds a number. Expects QNAN in rcx, and
+// clobbers rsi.
+static void emitCheckNumber(Assembler* as, Register value, int label) {
+    emitAlu(as, ALU_MOV, RSI, value);
+    emitAlu(as, ALU_AND, RSI, RCX);
+    emitAlu(as, ALU_CMP, RSI, RCX);
+    emitJumpIf(as, CC_E, label);
+}
+
+// Loads the two numbers on top of the stack into xmm0 and xmm1, leaving the
+// instruction at [offset] to the interpreter if either is something else.
+static void emitNumberOperands(Assembler* as, int offset) {
+    int slowPath = sideExit(as, offset);
+
+    emitLoad(as, RAX, RBX, -2 * (int)sizeof(Value));
+    emitLoad(as, RDX, RBX, -(int)sizeof(Value));
+    emitMoveImmediate(as, RCX, QNAN);
+    emitCheckNumber(as, RAX, slowPath);
+    emitCheckNumber(as, RDX, slowPath);
+    emitMoveToXmm(as, XMM0, RAX);
+    emitMoveToXmm(as, XMM1, RDX);
+}
+
+// Loads the number in local [slot] into xmm0 and the constant [constant],
+// which the optimizer made sure is a number, into xmm1.
+static void emitLocalConstantOperands(Assembler* as, int offset, int slot, int constant) {
+    int slowPath = sideExit(as, offset);
+
+    emitLoad(as, RAX, R12, slot * (int)sizeof(Value));
+    emitMoveImmediate(as, RCX, QNAN);
+    emitCheckNumber(as, RAX, slowPath);
+    emitMoveToXmm(as, XMM0, RAX);
+    emitLoad(as, RDX, R14, constant * (int)sizeof(Value));
+    emitMoveToXmm(as, XMM1, RDX);
+}
+
+// Replaces the two operands on top of the stack with [result].
+static void emitBinaryResult(Assembler* as, Register result) {
+    emitStore(as, RBX, -2 * (int)sizeof(Value), result);
+    emitAddImmediate(as, RBX, -(int)sizeof(Value));
+}
+
+// Turns the low byte of rax, which is 0 or 1, into false or true.
+static void emitBoolFromByte(Assembler* as) {
+    emitBytes(as, 0x0f, 0xb6);
+    emitByte(as, 0xc0);
+    emitMoveImmediate(as, RCX, FALSE_VAL);
+    emitAlu(as, ALU_ADD, RAX, RCX);
+}
+
+static void emitArithmetic(Assembler* as, int offset, uint8_t op) {
+    emitNumberOperands(as, offset);
+    emitSse(as, 0xf2, op, XMM0, XMM1);
+    emitMoveFromXmm(as, RAX, XMM0);
+    emitBinaryResult(as, RAX);
+}
+
+// Compares the operands with ucomisd. The comparisons are all phrased as
+// "above" or "below or equal" so that NaN, which compares as unordered and
+// sets both the carry and the zero flag, gives the same answer as in C.
+static void emitComparison(Assembler* as, int offset, XmmRegister left, XmmRegister right, Condition condition) {
+    emitNumberOperands(as, offset);
+    emitSse(as, 0x66, 0x2e, left, right);
+    emitSetCondition(as, condition, RAX);
+    emitBoolFromByte(as);
+    emitBinaryResult(as, RAX);
+}
+
+// Compares two values the way OP_EQUAL does. Returns 2 when they can only
+// be compared once lazy strings among them are flattened, which allocates,
+// so is left to the interpreter.
+static int jitEqual(Value a, Value b) {
+    if (valuesEqual(a, b)) return 1;
+    if (IS_LAZY_STRING(a) || IS_LAZY_STRING(b)) return 2;
+
+    return 0;
+}
+
+static void emitEquality(Assembler* as, int offset, bool negate) {
+    int slowPath = sideExit(as, offset);
+
+    emitLoad(as, RDI, RBX, -2 * (int)sizeof(Value));
+    emitLoad(as, RSI, RBX, -(int)sizeof(Value));
+    emitCall(as, (void*)jitEqual);
+
+    // cmp eax, 2
+    emitBytes(as, 0x83, 0xf8);
+    emitByte(as, 2);
+    emitJumpIf(as, CC_E, slowPath);
+
+    if (negate) {
+        // xor eax, 1
+        emitBytes(as, 0x83, 0xf0);
+        emitByte(as, 1);
+    }
+
+    emitBoolFromByte(as);
+    emitBinaryResult(as, RAX);
+}
+
+// Jumps to [label] if [value] is null or false.
+static void emitJumpIfFalsey(Assembler* as, Register value, int label) {
+    emitMoveImmediate(as, RCX, NULL_VAL);
+    emitAlu(as, ALU_CMP, value, RCX);
+    emitJumpIf(as, CC_E, label);
+    emitMoveImmediate(as, RCX, FALSE_VAL);
+    emitAlu(as, ALU_CMP, value, RCX);
+    emitJumpIf(as, CC_E, label);
+}
+
+static int readShort(uint8_t* code) {
+    return (code[0] << 8) | code[1];
+}
+
+// Emits the machine code for the instruction at bytecode [offset]. Returns
+// false for instructions that are always left to the interpreter.
+static bool emitInstruction(Assembler* as, int offset) {
+    uint8_t* code = as->chunk->code + offset;
+    int next = offset + instructionLength(as->chunk, offset);
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            emitLoad(as, RAX, R14, code[1] * (int)sizeof(Value));
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_NULL:
+            emitMoveImmediate(as, RAX, NULL_VAL);
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_TRUE:
+            emitMoveImmediate(as, RAX, TRUE_VAL);
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_FALSE:
+            emitMoveImmediate(as, RAX, FALSE_VAL);
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_POP:
+            emitAddImmediate(as, RBX, -(int)sizeof(Value));
+            return true;
+
+        case OP_GET_LOCAL:
+            emitLoad(as, RAX, R12, code[1] * (int)sizeof(Value));
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_SET_LOCAL:
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitStore(as, R12, code[1] * (int)sizeof(Value), RAX);
+            return true;
+
+        case OP_CONSTANT_LONG: {
+            int constant = (code[1] << 16) | readShort(code + 2);
+            emitLoad(as, RAX, R14, constant * (int)sizeof(Value));
+            emitPushValue(as, RAX);
+            return true;
+        }
+
+        case OP_GET_LOCAL_LONG:
+            emitLoad(as, RAX, R12, readShort(code + 1) * (int)sizeof(Value));
+            emitPushValue(as, RAX);
+            return true;
+
+        case OP_SET_LOCAL_LONG:
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitStore(as, R12, readShort(code + 1) * (int)sizeof(Value), RAX);
+            return true;
+
+        case OP_GET_LOCAL_GET_LOCAL:
+            emitLoad(as, RAX, R12, code[1] * (int)sizeof(Value));
+            emitLoad(as, RDX, R12, code[2] * (int)sizeof(Value));
+            emitStore(as, RBX, 0, RAX);
+            emitStore(as, RBX, sizeof(Value), RDX);
+            emitAddImmediate(as, RBX, 2 * sizeof(Value));
+            return true;
+
+        case OP_SET_LOCAL_POP:
+            emitAddImmediate(as, RBX, -(int)sizeof(Value));
+            emitLoad(as, RAX, RBX, 0);
+            emitStore(as, R12, code[1] * (int)sizeof(Value), RAX);
+            return true;
+
+        case OP_GET_GLOBAL: {
+            // The globals array moves as it grows, so it is loaded afresh
+            // from the VM each time. Undefined globals are an error, which
+            // the interpreter reports.
+            int slowPath = sideExit(as, offset);
+            emitLoad(as, RDX, R15, offsetof(GhostVM, globalValues) + offsetof(ValueArray, values));
+            emitLoad(as, RAX, RDX, readShort(code + 1) * (int)sizeof(Value));
+            emitMoveImmediate(as, RCX, UNDEFINED_VAL);
+            emitAlu(as, ALU_CMP, RAX, RCX);
+            emitJumpIf(as, CC_E, slowPath);
+            emitPushValue(as, RAX);
+            return true;
+        }
+
+        case OP_SET_GLOBAL: {
+            int slowPath = sideExit(as, offset);
+            int32_t displacement = readShort(code + 1) * (int)sizeof(Value);
+            emitLoad(as, RDX, R15, offsetof(GhostVM, globalValues) + offsetof(ValueArray, values));
+            emitLoad(as, RAX, RDX, displacement);
+            emitMoveImmediate(as, RCX, UNDEFINED_VAL);
+            emitAlu(as, ALU_CMP, RAX, RCX);
+            emitJumpIf(as, CC_E, slowPath);
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitStore(as, RDX, displacement, RAX);
+            return true;
+        }
+
+        case OP_DEFINE_GLOBAL:
+            emitLoad(as, RDX, R15, offsetof(GhostVM, globalValues) + offsetof(ValueArray, values));
+            emitAddImmediate(as, RBX, -(int)sizeof(Value));
+            emitLoad(as, RAX, RBX, 0);
+            emitStore(as, RDX, readShort(code + 1) * (int)sizeof(Value), RAX);
+            return true;
+
+        case OP_GET_UPVALUE:
+            emitLoad(as, RAX, R13, offsetof(JitContext, upvalues));
+            emitLoad(as, RAX, RAX, code[1] * (int)sizeof(ObjUpvalue*));
+            emitLoad(as, RAX, RAX, offsetof(ObjUpvalue, location));
+            emitLoad(as, RAX, RAX, 0);
+            emitPushValue(as, RAX);
+            return true;
+
+        // Quickened instructions compile to the same code as the generic
+        // ones, which only handle numbers here anyway.
+        case OP_ADD:
+        case OP_ADD_NUM: emitArithmetic(as, offset, 0x58); return true;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM: emitArithmetic(as, offset, 0x5c); return true;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM: emitArithmetic(as, offset, 0x59); return true;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM: emitArithmetic(as, offset, 0x5e); return true;
+
+        case OP_MODULO:
+            emitNumberOperands(as, offset);
+            emitCall(as, (void*)fmod);
+            emitMoveFromXmm(as, RAX, XMM0);
+            emitBinaryResult(as, RAX);
+            return true;
+
+        case OP_LESS:
+        case OP_LESS_NUM: emitComparison(as, offset, XMM1, XMM0, CC_A); return true;
+        case OP_GREATER:
+        case OP_GREATER_NUM: emitComparison(as, offset, XMM0, XMM1, CC_A); return true;
+        case OP_GREATER_EQUAL:
+        case OP_GREATER_EQUAL_NUM: emitComparison(as, offset, XMM1, XMM0, CC_BE); return true;
+        case OP_LESS_EQUAL:
+        case OP_LESS_EQUAL_NUM: emitComparison(as, offset, XMM0, XMM1, CC_BE); return true;
+
+        case OP_EQUAL: emitEquality(as, offset, false); return true;
+        case OP_NOT_EQUAL: emitEquality(as, offset, true); return true;
+
+        case OP_NOT:
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitMoveImmediate(as, RCX, NULL_VAL);
+            emitAlu(as, ALU_CMP, RAX, RCX);
+            emitSetCondition(as, CC_E, RCX);
+            emitMoveImmediate(as, RDX, FALSE_VAL);
+            emitAlu(as, ALU_CMP, RAX, RDX);
+            emitSetCondition(as, CC_E, RDX);
+
+            // or cl, dl
+            emitBytes(as, 0x08, 0xd1);
+            emitAlu(as, ALU_MOV, RAX, RCX);
+            emitBoolFromByte(as);
+            emitStore(as, RBX, -(int)sizeof(Value), RAX);
+            return true;
+
+        case OP_NEGATE: {
+            int slowPath = sideExit(as, offset);
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitMoveImmediate(as, RCX, QNAN);
+            emitCheckNumber(as, RAX, slowPath);
+            emitMoveImmediate(as, RCX, SIGN_BIT);
+            emitAlu(as, ALU_XOR, RAX, RCX);
+            emitStore(as, RBX, -(int)sizeof(Value), RAX);
+            return true;
+        }
+
+        case OP_JUMP:
+            emitJump(as, next + readShort(code + 1));
+            return true;
+
+        case OP_LOOP:
+            emitJump(as, next - readShort(code + 1));
+            return true;
+
+        case OP_JUMP_IF_FALSE:
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitJumpIfFalsey(as, RAX, next + readShort(code + 1));
+            return true;
+
+        case OP_JUMP_IF_TRUE:
+            emitLoad(as, RAX, RBX, -(int)sizeof(Value));
+            emitJumpIfFalsey(as, RAX, next);
+            emitJump(as, next + readShort(code + 1));
+            return true;
+
+        case OP_LESS_LOCAL_CONST_JUMP:
+            emitLocalConstantOperands(as, offset, code[1], code[2]);
+            emitSse(as, 0x66, 0x2e, XMM1, XMM0);
+            emitJumpIf(as, CC_BE, next + readShort(code + 3));
+            return true;
+
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            emitLocalConstantOperands(as, offset, code[1], code[2]);
+            emitSse(as, 0x66, 0x2e, XMM0, XMM1);
+            emitJumpIf(as, CC_BE, next + readShort(code + 3));
+            return true;
+
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUBTRACT_LOCAL_CONST:
+            emitLocalConstantOperands(as, offset, code[1], code[2]);
+            emitSse(as, 0xf2, code[0] == OP_ADD_LOCAL_CONST ? 0x58 : 0x5c, XMM0, XMM1);
+            emitMoveFromXmm(as, RAX, XMM0);
+            emitPushValue(as, RAX);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void freeAssembler(Assembler* as) {
+    FREE_ARRAY(as->vm, uint8_t, as->code, as->capacity);
+    FREE_ARRAY(as->vm, int, as->labels, as->labelCapacity);
+    FREE_ARRAY(as->vm, Fixup, as->fixups, as->fixupCapacity);
+    FREE_ARRAY(as->vm, SideExit, as->sideExits, as->sideExitCapacity);
+}
+
+bool jitCompile(GhostVM *vm, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+
+    Assembler as;
+    as.vm = vm;
+    as.chunk = chunk;
+    as.code = NULL;
+    as.count = 0;
+    as.capacity = 0;
+    as.labels = NULL;
+    as.labelCount = 0;
+    as.labelCapacity = 0;
+    as.fixups = NULL;
+    as.fixupCount = 0;
+    as.fixupCapacity = 0;
+    as.sideExits = NULL;
+    as.sideExitCount = 0;
+    as.sideExitCapacity = 0;
+
+    for (int i = 0; i < chunk->count; i++) newLabel(&as);
+    as.exitLabel = newLabel(&as);
+
+    uint8_t** entries = ALLOCATE(vm, uint8_t*, chunk->count);
+    bool* handled = ALLOCATE(vm, bool, chunk->count);
+
+    memset(handled, false, chunk->count);
+
+    emitPrologue(&as);
+
+    // The machine code is only entered where it runs into a loop before it
+    // has to exit again. Anywhere else, entering and leaving it costs more
+    // than it saves, so those entries are dropped once the run they start
+    // turns out to end in an exit.
+    int runStart = 0;
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        bindLabel(&as, offset);
+
+        handled[offset] = emitInstruction(&as, offset);
+
+        if (!handled[offset]) {
+            emitExit(&as, offset);
+            memset(handled + runStart, false, offset - runStart);
+            runStart = offset + instructionLength(chunk, offset);
+        } else if (chunk->code[offset] == OP_LOOP) {
+            runStart = offset + instructionLength(chunk, offset);
+        }
+    }
+
+    for (int i = 0; i < as.sideExitCount; i++) {
+        bindLabel(&as, as.sideExits[i].label);
+        emitExit(&as, as.sideExits[i].offset);
+    }
+
+    bindLabel(&as, as.exitLabel);
+    emitEpilogue(&as);
+
+    for (int i = 0; i < as.fixupCount; i++) {
+        int position = as.fixups[i].position;
+        int32_t displacement = as.labels[as.fixups[i].label] - (position + 4);
+        memcpy(as.code + position, &displacement, sizeof(displacement));
+    }
+
+    size_t size = as.count;
+    uint8_t* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code != MAP_FAILED) {
+        memcpy(code, as.code, size);
+
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, size);
+            code = MAP_FAILED;
+        }
+    }
+
+    if (code != MAP_FAILED) {
+        for (int offset = 0; offset < chunk->count; offset++) {
+            entries[offset] = handled[offset] ? code + as.labels[offset] : NULL;
+        }
+    }
+
+    FREE_ARRAY(vm, bool, handled, chunk->count);
+    freeAssembler(&as);
+
+    if (code == MAP_FAILED) {
+        FREE_ARRAY(vm, uint8_t*, entries, chunk->count);
+        return false;
+    }
+
+    JitCode* jit = ALLOCATE(vm, JitCode, 1);
+    jit->code = code;
+    jit->size = size;
+    jit->entries = entries;
+    jit->entryCount = chunk->count;
+    function->jitCode = jit;
+
+    return true;
+}
+
+void jitRun(GhostVM *vm, CallFrame* frame, uint8_t* entry) {
+    ObjFunction* function = frame->closure->function;
+
+    JitContext context;
+    context.stackTop = vm->stackTop;
+    context.slots = frame->slots;
+    context.constants = function->chunk.constants.values;
+    context.upvalues = frame->closure->upvalues;
+    context.vm = vm;
+    context.ip = frame->ip;
+
+    JitEnterFn enter = (JitEnterFn)(void*)function->jitCode->code;
+    enter(&context, entry);
+
+    frame->ip = context.ip;
+    vm->stackTop = context.stackTop;
+}
+
+void jitFree(GhostVM *vm, ObjFunction* function) {
+    JitCode* jit = function->jitCode;
+    if (jit == NULL) return;
+
+    munmap(jit->code, jit->size);
+    FREE_ARRAY(vm, uint8_t*, jit->entries, jit->entryCount);
+    FREE(vm, JitCode, jit);
+
+    function->jitCode = NULL;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef ghost_jit_h
+#define ghost_jit_h
+
+// The baseline JIT translates the bytecode of hot functions into x86-64
+// machine code, one template per instruction. It only takes over the simple
+// instructions that make up numeric loops: stack shuffling, locals, globals,
+// arithmetic, comparisons and jumps. Anything else -- calls, returns, objects,
+// and the slow path of the instructions it does handle -- hands the frame
+// back to the interpreter at that instruction, which carries on from there
+// and re-enters the machine code at the next call, return or loop.
+//
+// Machine code never allocates, pushes a frame or raises an error itself, so
+// the call frames, the garbage collector's roots and runtime error stack
+// traces all work exactly as when interpreting.
+
+#include "include/ghost.h"
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+#if JIT_COMPILER
+
+typedef struct sJitCode {
+    // The executable memory holding the machine code.
+    uint8_t* code;
+    size_t size;
+
+    // For each byte offset in the function's bytecode that starts an
+    // instruction the machine code handles, where that instruction's code
+    // starts. NULL everywhere else.
+    uint8_t** entries;
+    int entryCount;
+} JitCode;
+
+// Compiles [function] to machine code. Returns false if that is not
+// possible, in which case the function stays interpreted.
+bool jitCompile(GhostVM *vm, ObjFunction* function);
+
+// Runs the machine code of the function in [frame] from [entry], as returned
+// by jitEntry() for [frame->ip], until it reaches an instruction it leaves to
+// the interpreter. [frame->ip] and [vm->stackTop] are updated to where it
+// stopped.
+void jitRun(GhostVM *vm, CallFrame* frame, uint8_t* entry);
+
+void jitFree(GhostVM *vm, ObjFunction* function);
+
+// Returns where to enter the machine code of [function] to continue at
+// [ip], compiling it if it has only just become hot. Returns NULL if the
+// interpreter should carry on instead.
+static inline uint8_t* jitEntry(GhostVM *vm, ObjFunction* function, uint8_t* ip) {
+    if (function->jitCode == NULL) {
+        // Functions that failed to compile stay at the threshold.
+        if (function->hotness >= vm->jitThreshold) return NULL;
+        if (++function->hotness < vm->jitThreshold) return NULL;
+        if (!jitCompile(vm, function)) return NULL;
+    }
+
+    return function->jitCode->entries[ip - function->chunk.code];
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -7,16 +7,13 @@
 #include "chunk.h"
 #include "debug.h"
 #include "include/ghost.h"
-#include "utilities.h"
 #include "vm.h"
 #include "vendor/linenoise.h"
 
-#define VERSION "dev-master"
-
 static void repl(GhostVM *vm) {
     char *line;
 
-    puts("Ghost (" ANSI_COLOR_CYAN VERSION ANSI_COLOR_RESET ")");
+    puts("Ghost (" ANSI_COLOR_CYAN GHOST_VERSION ANSI_COLOR_RESET ")");
     puts("Press Ctrl + C to exit\n");
 
     linenoiseHistoryLoad("ghost_history.txt");
@@ -35,20 +32,32 @@ static void repl(GhostVM *vm) {
 
 static void *reallocate(void *memory, size_t oldSize, size_t newSize)
 {
+    if (newSize == 0) {
+        free(memory);
+        return NULL;
+    }
+
     return realloc(memory, newSize);
 }
 
 static void runFile(GhostVM *vm, const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = ghostInterpret(vm, source);
-    free(source);
+    InterpretResult result = ghostInterpretFile(vm, path);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
 int main(int argc, const char* argv[]) {
-    GhostVM *vm = ghostNewVM(reallocate);
+    GhostConfiguration configuration;
+    ghostInitConfiguration(&configuration);
+    configuration.reallocateFn = reallocate;
+
+    // GHOST_JIT overrides the JIT threshold, so that "GHOST_JIT=0" turns the
+    // JIT off and "GHOST_JIT=1" compiles every function on its first call.
+    const char* jitThreshold = getenv("GHOST_JIT");
+    if (jitThreshold != NULL) configuration.jitThreshold = atoi(jitThreshold);
+
+    GhostVM *vm = ghostNewVM(&configuration);
 
     if (argc == 1) {
         repl(vm);
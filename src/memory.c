@@ -3,7 +3,9 @@
 #include "common.h"
 #include "compiler.h"
 #include "include/ghost.h"
+#include "jit.h"
 #include "memory.h"
+#include "pool.h"
 #include "vm.h"
 
 #if DEBUG_LOG_GC
@@ -13,26 +15,72 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
+static void collectNursery(GhostVM *vm);
+static void beginCollection(GhostVM *vm);
+static void collectStep(GhostVM *vm, size_t budget);
+
+// Called whenever memory grows, to start or advance a collection.
+static void collectIfNeeded(GhostVM *vm) {
+    #if DEBUG_STRESS_GC
+        if (vm->gcPhase != GC_PHASE_IDLE) {
+            collectStep(vm, 1);
+        } else if (vm->generational) {
+            collectNursery(vm);
+        } else {
+            collectGarbage(vm);
+        }
+    #endif
+
+    // A whole-heap collection in progress advances a bounded step with
+    // every allocation, and the nursery waits until it has finished.
+    if (vm->gcPhase != GC_PHASE_IDLE) {
+        collectStep(vm, vm->gcStepSize);
+    } else if (vm->bytesAllocated > vm->nextGC) {
+        if (vm->gcStepSize == 0) {
+            collectGarbage(vm);
+        } else {
+            beginCollection(vm);
+        }
+    } else if (vm->generational && vm->bytesAllocated > vm->nurseryLimit) {
+        collectNursery(vm);
+    }
+}
+
 void* reallocate(GhostVM *vm, void* previous, size_t oldSize, size_t newSize) {
     vm->bytesAllocated += newSize - oldSize;
 
-    if (newSize > oldSize) {
-        #if DEBUG_STRESS_GC
-            collectGarbage();
-        #endif
-    }
+    if (newSize > oldSize) collectIfNeeded(vm);
 
-    if (vm->bytesAllocated > vm->nextGC) {
-        collectGarbage(vm);
-    }
+    return vm->reallocateFn(previous, oldSize, newSize);
+}
+
+void* allocateObjectMemory(GhostVM *vm, size_t size) {
+    vm->bytesAllocated += size;
+    collectIfNeeded(vm);
 
-    if (newSize == 0) {
-        free(previous);
+    if (size > POOL_MAX_SIZE) return vm->reallocateFn(NULL, 0, size);
+
+    return poolAllocate(vm, &vm->pool, size);
+}
 
-        return NULL;
+void freeObjectMemory(GhostVM *vm, void* object, size_t size) {
+    vm->bytesAllocated -= size;
+
+    if (size > POOL_MAX_SIZE) {
+        vm->reallocateFn(object, size, 0);
+    } else {
+        poolFree(&vm->pool, object);
     }
+}
 
-    return realloc(previous, newSize);
+static void pushGray(GhostVM *vm, Obj* object) {
+    if (vm->grayCapacity < vm->grayCount + 1) {
+        int oldCapacity = vm->grayCapacity;
+        vm->grayCapacity = GROW_CAPACITY(oldCapacity);
+        vm->grayStack = vm->reallocateFn(vm->grayStack, sizeof(Obj*) * oldCapacity, sizeof(Obj*) * vm->grayCapacity);
+    }
+
+    vm->grayStack[vm->grayCount++] = object;
 }
 
 void markObject(GhostVM *vm, Obj* object) {
@@ -47,12 +95,11 @@ void markObject(GhostVM *vm, Obj* object) {
 
     object->isMarked = true;
 
-    if (vm->grayCapacity < vm->grayCount + 1) {
-        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
-        vm->grayStack = realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
-    }
+    // Strings and float arrays reference nothing, so there is nothing to
+    // trace.
+    if (object->type == OBJ_STRING || object->type == OBJ_FLOAT_ARRAY) return;
 
-    vm->grayStack[vm->grayCount++] = object;
+    pushGray(vm, object);
 }
 
 void markValue(GhostVM *vm, Value value) {
@@ -66,6 +113,32 @@ static void markArray(GhostVM *vm, ValueArray* array) {
     }
 }
 
+// Called when the marked [object] is given a reference to an unmarked one.
+// While a collection is marking, [object] may already have been traced, so
+// it goes back on the gray stack. Otherwise only the generational collector
+// cares: [object] is old, and the next nursery collection has to trace it
+// to find the young object.
+void rememberObject(GhostVM *vm, Obj* object) {
+    if (vm->gcPhase == GC_PHASE_MARK) {
+        object->isRemembered = true;
+        pushGray(vm, object);
+        return;
+    }
+
+    // While clearing, every object is about to be traced from scratch.
+    if (!vm->generational || vm->gcPhase == GC_PHASE_CLEAR) return;
+
+    object->isRemembered = true;
+
+    if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+        int oldCapacity = vm->rememberedCapacity;
+        vm->rememberedCapacity = GROW_CAPACITY(oldCapacity);
+        vm->remembered = vm->reallocateFn(vm->remembered, sizeof(Obj*) * oldCapacity, sizeof(Obj*) * vm->rememberedCapacity);
+    }
+
+    vm->remembered[vm->rememberedCount++] = object;
+}
+
 static void blackenObject(GhostVM *vm, Obj* object) {
     #if DEBUG_LOG_GC
         printf("%p blacken ", (void*)object);
@@ -73,6 +146,8 @@ static void blackenObject(GhostVM *vm, Obj* object) {
         printf("\n");
     #endif
 
+    object->isRemembered = false;
+
     switch (object->type) {
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* bound = (ObjBoundMethod*)object;
@@ -115,7 +190,17 @@ static void blackenObject(GhostVM *vm, Obj* object) {
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             markObject(vm, (Obj*)instance->klass);
-            markTable(vm, &instance->fields);
+
+            if (instance->shape != NULL) {
+                for (int i = 0; i < instance->shape->fieldCount; i++) {
+                    markValue(vm, *instanceField(instance, i));
+                }
+            }
+
+            // While an instance is being moved to a dictionary it has both.
+            if (instance->dictionary != NULL) {
+                markTable(vm, instance->dictionary);
+            }
             break;
         }
 
@@ -123,9 +208,41 @@ static void blackenObject(GhostVM *vm, Obj* object) {
             markValue(vm, ((ObjUpvalue*)object)->closed);
             break;
 
+        case OBJ_LIST:
+            markArray(vm, &((ObjList*)object)->values);
+            break;
+
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+
+            for (int i = 0; i < map->capacity; i++) {
+                MapEntry* entry = &map->entries[i];
+                if (entry->distance == 0) continue;
+
+                markValue(vm, entry->key);
+                markValue(vm, entry->value);
+            }
+            break;
+        }
+
+        case OBJ_MODULE: {
+            ObjModule* module = (ObjModule*)object;
+            markObject(vm, (Obj*)module->path);
+            markObject(vm, (Obj*)module->function);
+            break;
+        }
+
+        case OBJ_LAZY_STRING: {
+            ObjLazyString* string = (ObjLazyString*)object;
+            markObject(vm, (Obj*)string->buffer);
+            markObject(vm, (Obj*)string->flattened);
+            break;
+        }
+
         case OBJ_NATIVE:
         case OBJ_STRING:
-        case OBJ_LIST:
+        case OBJ_STRING_BUFFER:
+        case OBJ_FLOAT_ARRAY:
             break;
     }
 }
@@ -137,69 +254,132 @@ static void freeObject(GhostVM* vm, Obj* object) {
 
     switch (object->type) {
         case OBJ_BOUND_METHOD:
-            FREE(vm, ObjBoundMethod, object);
+            FREE_OBJ(vm, ObjBoundMethod, object);
             break;
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
             freeTable(vm, &klass->methods);
-            FREE(vm, ObjClass, object);
+            FREE_OBJ(vm, ObjClass, object);
             break;
         }
 
         case OBJ_NATIVE_CLASS: {
             ObjNativeClass* klass = (ObjNativeClass*)object;
             freeTable(vm, &klass->methods);
-            FREE(vm, ObjClass, object);
+            FREE_OBJ(vm, ObjNativeClass, object);
             break;
         }
 
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(vm, ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(vm, ObjClosure, object);
+            FREE_OBJ(vm, ObjClosure, object);
             break;
         }
 
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
+            #if JIT_COMPILER
+                jitFree(vm, function);
+            #endif
             freeChunk(vm, &function->chunk);
-            FREE(vm, ObjFunction, object);
+            FREE_OBJ(vm, ObjFunction, object);
             break;
         }
 
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(vm, &instance->fields);
-            FREE(vm, ObjInstance, object);
+
+            if (instance->dictionary != NULL) {
+                freeTable(vm, instance->dictionary);
+                FREE(vm, Table, instance->dictionary);
+            }
+
+            FREE_ARRAY(vm, Value, instance->overflow, instance->overflowCapacity);
+            freeObjectMemory(vm, object, sizeof(ObjInstance) + sizeof(Value) * instance->inlineCapacity);
             break;
         }
 
         case OBJ_NATIVE: {
-            FREE(vm, ObjNative, object);
+            FREE_OBJ(vm, ObjNative, object);
             break;
         }
 
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
 
-            FREE_ARRAY(vm, char, string->chars, string->length + 1);
-            FREE(vm, ObjString, object);
+            // The string table holds its keys weakly.
+            tableDelete(&vm->strings, string);
+
+            size_t size = sizeof(ObjString);
+            if (string->chars == string->inlineChars) size += string->length + 1;
+
+            freeObjectMemory(vm, object, size);
 
             break;
         }
 
         case OBJ_UPVALUE: {
-            FREE(vm, ObjUpvalue, object);
+            FREE_OBJ(vm, ObjUpvalue, object);
             break;
         }
 
         case OBJ_LIST: {
+            ObjList* list = (ObjList*)object;
+            freeValueArray(vm, &list->values);
+            FREE_OBJ(vm, ObjList, object);
+            break;
+        }
+
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray* array = (ObjFloatArray*)object;
+            freeObjectMemory(vm, object, sizeof(ObjFloatArray) + sizeof(double) * array->count);
+            break;
+        }
+
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            FREE_ARRAY(vm, MapEntry, map->entries, map->capacity);
+            FREE_OBJ(vm, ObjMap, object);
+            break;
+        }
+
+        case OBJ_MODULE: {
+            FREE_OBJ(vm, ObjModule, object);
+            break;
+        }
+
+        case OBJ_LAZY_STRING: {
+            FREE_OBJ(vm, ObjLazyString, object);
+            break;
+        }
+
+        case OBJ_STRING_BUFFER: {
+            ObjStringBuffer* buffer = (ObjStringBuffer*)object;
+            FREE_ARRAY(vm, char, buffer->chars, buffer->capacity);
+            FREE_OBJ(vm, ObjStringBuffer, object);
             break;
         }
     }
 }
 
-static void markRoots(GhostVM *vm) {
+// Marks the roots that only ever grow: the global and module tables, the
+// shapes and the VM's own objects. A whole-heap collection marks these once
+// when marking begins, and markNewRoot() covers whatever is added to them
+// after that.
+static void markFixedRoots(GhostVM *vm) {
+    markTable(vm, &vm->globalSlots);
+    markTable(vm, &vm->modules);
+    markShapes(vm);
+    markObject(vm, (Obj*)vm->constructorString);
+    markObject(vm, (Obj*)vm->listClass);
+    markObject(vm, (Obj*)vm->mapClass);
+    markObject(vm, (Obj*)vm->floatArrayClass);
+}
+
+// Marks the roots that are written without a barrier: the stack, the values
+// of the globals and whatever the compiler is holding.
+static void markMutableRoots(GhostVM *vm) {
     for(Value* slot = vm->stack; slot < vm->stackTop; slot++) {
         markValue(vm, *slot);
     }
@@ -212,9 +392,17 @@ static void markRoots(GhostVM *vm) {
         markObject(vm, (Obj*)upvalue);
     }
 
-    markTable(vm, &vm->globals);
-    markCompilerRoots();
-    markObject(vm, (Obj*)vm->constructorString);
+    markArray(vm, &vm->globalValues);
+    markCompilerRoots(vm);
+}
+
+static void markRoots(GhostVM *vm) {
+    markFixedRoots(vm);
+    markMutableRoots(vm);
+}
+
+void markNewRoot(GhostVM *vm, Obj* object) {
+    if (vm->gcPhase == GC_PHASE_MARK) markObject(vm, object);
 }
 
 static void traceReferences(GhostVM *vm) {
@@ -224,57 +412,204 @@ static void traceReferences(GhostVM *vm) {
     }
 }
 
-static void sweep(GhostVM *vm) {
-    Obj* previous = NULL;
-    Obj* object = vm->objects;
+// Frees the unmarked objects in the nursery and promotes the rest.
+static void sweepNursery(GhostVM *vm) {
+    Obj* object = vm->youngObjects;
 
     while (object != NULL) {
+        Obj* next = object->next;
+
         if (object->isMarked) {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
+            object->next = vm->objects;
+            vm->objects = object;
         } else {
-            Obj* unreached = object;
-            object = object->next;
-
-            if (previous != NULL) {
-                previous->next = object;
-            } else {
-                vm->objects = object;
-            }
-
-            freeObject(vm, unreached);
+            freeObject(vm, object);
         }
+
+        object = next;
     }
+
+    vm->youngObjects = NULL;
 }
 
-void collectGarbage(GhostVM *vm) {
+// Collects only the objects allocated since the last collection. Old objects
+// are still marked from the collection that promoted them, so marking stops
+// as soon as it reaches one, except for the remembered objects that may
+// point back into the nursery.
+static void collectNursery(GhostVM *vm) {
     #if DEBUG_LOG_GC
-        printf("-- gc begin\n");
-        size_t before = vm.bytesAllocated;
+        printf("-- nursery gc begin\n");
+        size_t before = vm->bytesAllocated;
     #endif
 
     markRoots(vm);
+
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        blackenObject(vm, vm->remembered[i]);
+    }
+
+    vm->rememberedCount = 0;
+
     traceReferences(vm);
-    tableRemoveWhite(&vm->strings);
-    sweep(vm);
+    sweepNursery(vm);
+    poolReleaseEmptySlabs(vm, &vm->pool);
+
+    vm->nurseryLimit = vm->bytesAllocated + vm->nurserySize;
+
+    #if DEBUG_LOG_GC
+        printf("-- nursery gc end\n");
+        printf("   collected %ld bytes (from %ld to %ld)\n", before - vm->bytesAllocated, before, vm->bytesAllocated);
+    #endif
+}
+
+// A whole-heap collection runs in phases, each of which can be split into
+// steps that do a bounded amount of work between allocations:
+//
+// - With the generational collector, old objects are still marked, so the
+//   clear phase unmarks them first.
+//
+// - The mark phase blackens gray objects. The mutator keeps running, so
+//   objects allocated meanwhile start out gray, and the write barrier puts
+//   any marked object that is given an unmarked one back on the gray stack.
+//   The stack and the globals' values have no barrier, so once the gray
+//   stack is empty they are marked again, and marking only ends when that
+//   finds nothing new. The other roots only grow and are marked once.
+//
+// - The sweep phase frees what is still unmarked. Objects allocated from
+//   then on go on a fresh nursery list the sweep never visits.
+static void beginMark(GhostVM *vm) {
+    vm->gcPhase = GC_PHASE_MARK;
+    markRoots(vm);
+}
+
+static void beginSweep(GhostVM *vm) {
+    vm->gcPhase = GC_PHASE_SWEEP;
+
+    vm->sweepOld = vm->objects;
+    vm->sweepYoung = vm->youngObjects;
+    vm->objects = NULL;
+    vm->youngObjects = NULL;
+}
+
+static void endCollection(GhostVM *vm) {
+    vm->gcPhase = GC_PHASE_IDLE;
+    poolReleaseEmptySlabs(vm, &vm->pool);
 
     vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm->nurseryLimit = vm->bytesAllocated + vm->nurserySize;
 
     #if DEBUG_LOG_GC
-            printf("-- gc end\n");
-            printf("   collected %ld bytes (from %ld to %ld) next at %ld\n", before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC);
+        printf("-- gc end\n");
+        printf("   %ld bytes in use, next at %ld\n", vm->bytesAllocated, vm->nextGC);
     #endif
 }
 
-void freeObjects(GhostVM *vm) {
-    Obj* object = vm->objects;
+static void beginCollection(GhostVM *vm) {
+    #if DEBUG_LOG_GC
+        printf("-- gc begin\n");
+    #endif
+
+    // Everything is traced from scratch, remembered or not.
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        vm->remembered[i]->isRemembered = false;
+    }
+
+    vm->rememberedCount = 0;
+
+    if (vm->generational) {
+        vm->gcPhase = GC_PHASE_CLEAR;
+        vm->clearCursor = vm->objects;
+    } else {
+        beginMark(vm);
+    }
+}
+
+// Does at most [budget] objects' worth of work on the collection in
+// progress.
+static void collectStep(GhostVM *vm, size_t budget) {
+    switch (vm->gcPhase) {
+        case GC_PHASE_IDLE:
+            break;
 
+        case GC_PHASE_CLEAR:
+            while (budget > 0 && vm->clearCursor != NULL) {
+                vm->clearCursor->isMarked = false;
+                vm->clearCursor = vm->clearCursor->next;
+                budget--;
+            }
+
+            if (vm->clearCursor == NULL) beginMark(vm);
+            break;
+
+        case GC_PHASE_MARK:
+            while (budget > 0 && vm->grayCount > 0) {
+                blackenObject(vm, vm->grayStack[--vm->grayCount]);
+                budget--;
+            }
+
+            if (vm->grayCount == 0) {
+                markMutableRoots(vm);
+
+                if (vm->grayCount == 0) beginSweep(vm);
+            }
+            break;
+
+        case GC_PHASE_SWEEP:
+            while (budget > 0 && (vm->sweepYoung != NULL || vm->sweepOld != NULL)) {
+                Obj** list = vm->sweepYoung != NULL ? &vm->sweepYoung : &vm->sweepOld;
+                Obj* object = *list;
+                *list = object->next;
+
+                if (object->isMarked) {
+                    // With the generational collector the survivors keep
+                    // their mark, which is what makes them old.
+                    object->isMarked = vm->generational;
+                    object->next = vm->objects;
+                    vm->objects = object;
+                } else {
+                    freeObject(vm, object);
+                }
+
+                budget--;
+            }
+
+            if (vm->sweepYoung == NULL && vm->sweepOld == NULL) endCollection(vm);
+            break;
+    }
+}
+
+static void finishCollection(GhostVM *vm) {
+    while (vm->gcPhase != GC_PHASE_IDLE) {
+        collectStep(vm, SIZE_MAX);
+    }
+}
+
+void collectGarbage(GhostVM *vm) {
+    // A collection already in progress may have missed objects that died
+    // after it started, so finish it and then run a whole new one.
+    finishCollection(vm);
+    beginCollection(vm);
+    finishCollection(vm);
+}
+
+static void freeList(GhostVM *vm, Obj* object) {
     while (object != NULL) {
         Obj* next = object->next;
         freeObject(vm, object);
         object = next;
     }
+}
+
+void freeObjects(GhostVM *vm) {
+    freeList(vm, vm->objects);
+    freeList(vm, vm->youngObjects);
+
+    if (vm->gcPhase == GC_PHASE_SWEEP) {
+        freeList(vm, vm->sweepOld);
+        freeList(vm, vm->sweepYoung);
+    }
 
-    free(vm->grayStack);
+    vm->reallocateFn(vm->grayStack, sizeof(Obj*) * vm->grayCapacity, 0);
+    vm->reallocateFn(vm->remembered, sizeof(Obj*) * vm->rememberedCapacity, 0);
+    freePool(vm, &vm->pool);
 }
\ No newline at end of file
@@ -20,10 +20,33 @@
 #define FREE_ARRAY(vm, type, pointer, oldCount) \
     reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
 
+#define FREE_OBJ(vm, type, pointer) \
+    freeObjectMemory(vm, pointer, sizeof(type))
+
 void* reallocate(GhostVM *vm, void* previous, size_t oldSize, size_t newSize);
+
+// Allocates and frees the memory for an object struct, which comes from the
+// VM's pool unless it is larger than POOL_MAX_SIZE.
+void* allocateObjectMemory(GhostVM *vm, size_t size);
+void freeObjectMemory(GhostVM *vm, void* object, size_t size);
 void markObject(GhostVM *vm, Obj* object);
 void markValue(GhostVM *vm, Value value);
+void rememberObject(GhostVM *vm, Obj* object);
+
+// Must be called with anything added to a root that is only marked when a
+// collection starts marking: the global and module tables and the shapes.
+void markNewRoot(GhostVM *vm, Obj* object);
 void collectGarbage(GhostVM *vm);
 void freeObjects(GhostVM *vm);
 
+// Must be called after [value] is stored inside [object]. It only has work to
+// do when a marked object is given an unmarked one: an old object getting a
+// young one with the generational collector, or an object that may already
+// have been traced getting one that hasn't while a collection is marking.
+static inline void writeBarrier(GhostVM *vm, Obj* object, Value value) {
+    if (object->isMarked && !object->isRemembered && IS_OBJ(value) && !AS_OBJ(value)->isMarked) {
+        rememberObject(vm, object);
+    }
+}
+
 #endif
\ No newline at end of file
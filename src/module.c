@@ -0,0 +1,79 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "module.h"
+#include "vm.h"
+
+// Each file is compiled at most once per VM for as long as it does not
+// change, however many times and from wherever it is included. Modules are
+// found by the path they were named by, which is cheap to look up, and the
+// first time a path is seen it is canonicalized so that different paths to
+// the same file share one module.
+
+static ObjModule* findModule(GhostVM *vm, ObjString* path) {
+    Value value;
+    if (tableGet(&vm->modules, path, &value)) return AS_MODULE(value);
+
+    // Paths that cannot be resolved, such as missing files, are left as they
+    // are so that compiling reports them.
+    char* resolved = realpath(path->chars, NULL);
+    ObjString* canonical = path;
+
+    if (resolved != NULL) {
+        canonical = copyString(vm, resolved, (int)strlen(resolved));
+        free(resolved);
+    }
+
+    push(vm, OBJ_VAL(canonical));
+
+    ObjModule* module;
+
+    if (tableGet(&vm->modules, canonical, &value)) {
+        module = AS_MODULE(value);
+    } else {
+        module = newModule(vm, canonical);
+        push(vm, OBJ_VAL(module));
+        tableSet(vm, &vm->modules, canonical, OBJ_VAL(module));
+        markNewRoot(vm, (Obj*)module);
+        pop(vm);
+    }
+
+    tableSet(vm, &vm->modules, path, OBJ_VAL(module));
+    markNewRoot(vm, (Obj*)canonical);
+    markNewRoot(vm, (Obj*)path);
+    pop(vm);
+
+    return module;
+}
+
+ObjModule* loadModule(GhostVM *vm, ObjString* path) {
+    ObjModule* module = findModule(vm, path);
+
+    struct stat status;
+    int64_t modified = 0;
+    int64_t size = 0;
+
+    if (stat(module->path->chars, &status) == 0) {
+        modified = (int64_t)status.st_mtime;
+        size = (int64_t)status.st_size;
+    }
+
+    if (module->function != NULL && module->modified == modified && module->size == size) {
+        return module;
+    }
+
+    ObjFunction* function = compileFile(vm, module->path->chars);
+    if (function == NULL) return NULL;
+
+    module->function = function;
+    module->modified = modified;
+    module->size = size;
+    writeBarrier(vm, (Obj*)module, OBJ_VAL(function));
+
+    return module;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef ghost_module_h
+#define ghost_module_h
+
+#include "include/ghost.h"
+#include "object.h"
+
+// Returns the module for the source file at [path], compiling it if this VM
+// has not seen it before or the file has changed since.
+//
+// Returns NULL if the source has a compile error.
+ObjModule* loadModule(GhostVM *vm, ObjString* path);
+
+#endif
\ No newline at end of file
@@ -336,7 +336,7 @@ assertLessThanOrEqual(GhostVM *vm, int argCount, Value *args)
 
 void registerAssertModule(GhostVM *vm)
 {
-    ObjString *name = copyString(vm, "Assert", 6);
+    ObjString *name = externalString(vm, "Assert", 6);
     push(vm, OBJ_VAL(name));
     ObjNativeClass *klass = newNativeClass(vm, name);
     push(vm, OBJ_VAL(klass));
@@ -353,7 +353,7 @@ void registerAssertModule(GhostVM *vm)
     defineNativeMethod(vm, klass, "lessThan", assertLessThan);
     defineNativeMethod(vm, klass, "lessThanOrEqual", assertLessThanOrEqual);
 
-    tableSet(vm, &vm->globals, name, OBJ_VAL(klass));
+    defineGlobal(vm, name, OBJ_VAL(klass));
     pop(vm);
     pop(vm);
 }
\ No newline at end of file
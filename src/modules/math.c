@@ -228,7 +228,7 @@ static Value mathPi(GhostVM *vm, int argCount, Value *args)
 
 void registerMathModule(GhostVM *vm)
 {
-    ObjString *name = copyString(vm, "Math", 4);
+    ObjString *name = externalString(vm, "Math", 4);
     push(vm, OBJ_VAL(name));
     ObjNativeClass *klass = newNativeClass(vm, name);
     push(vm, OBJ_VAL(klass));
@@ -244,7 +244,7 @@ void registerMathModule(GhostVM *vm)
     defineNativeMethod(vm, klass, "min", mathMin);
     defineNativeMethod(vm, klass, "pi", mathPi);
 
-    tableSet(vm, &vm->globals, name, OBJ_VAL(klass));
+    defineGlobal(vm, name, OBJ_VAL(klass));
     pop(vm);
     pop(vm);
 }
\ No newline at end of file
@@ -32,12 +32,7 @@ static Value inputNative(GhostVM *vm, int argCount, Value *args) {
     }
 
     uint64_t currentSize = 128;
-    char *line = malloc(currentSize);
-
-    if (line == NULL) {
-        runtimeError(vm, "Memory error on input()");
-        return NULL_VAL;
-    }
+    char *line = ALLOCATE(vm, char, currentSize);
 
     int c = EOF;
     uint64_t i = 0;
@@ -46,20 +41,16 @@ static Value inputNative(GhostVM *vm, int argCount, Value *args) {
         line[i++] = (char) c;
 
         if (i + 1 == currentSize) {
+            uint64_t oldSize = currentSize;
             currentSize = GROW_CAPACITY(currentSize);
-            line = realloc(line, currentSize);
-
-            if (line == NULL) {
-                printf("Unable to allocate memory.\n");
-                exit(71);
-            }
+            line = GROW_ARRAY(vm, line, char, oldSize, currentSize);
         }
     }
 
     line[i] = '\0';
 
     Value input = OBJ_VAL(copyString(vm, line, strlen(line)));
-    free(line);
+    FREE_ARRAY(vm, char, line, currentSize);
     return input;
 }
 
@@ -119,31 +110,88 @@ static Value typeNative(GhostVM *vm, int argCount, Value *args)
     }
 
     if (IS_BOOL(args[0])) {
-        return OBJ_VAL(copyString(vm, "bool", 4));
+        return OBJ_VAL(externalString(vm, "bool", 4));
     } else if (IS_NULL(args[0])) {
-        return OBJ_VAL(copyString(vm, "null", 4));
+        return OBJ_VAL(externalString(vm, "null", 4));
     } else if (IS_NUMBER(args[0])) {
-        return OBJ_VAL(copyString(vm, "number", 6));
+        return OBJ_VAL(externalString(vm, "number", 6));
     } else if (IS_OBJ(args[0])) {
         switch (OBJ_TYPE(args[0])) {
             case OBJ_CLASS:
-                return OBJ_VAL(copyString(vm, "class", 5));
+                return OBJ_VAL(externalString(vm, "class", 5));
             case OBJ_CLOSURE:
-                return OBJ_VAL(copyString(vm, "closure", 7));
+                return OBJ_VAL(externalString(vm, "closure", 7));
             case OBJ_FUNCTION:
-                return OBJ_VAL(copyString(vm, "function", 8));
+                return OBJ_VAL(externalString(vm, "function", 8));
             case OBJ_STRING:
-                return OBJ_VAL(copyString(vm, "string", 6));
+                return OBJ_VAL(externalString(vm, "string", 6));
             case OBJ_LIST:
-                return OBJ_VAL(copyString(vm, "list", 4));
+                return OBJ_VAL(externalString(vm, "list", 4));
+            case OBJ_FLOAT_ARRAY:
+                return OBJ_VAL(externalString(vm, "float64array", 12));
+            case OBJ_MAP:
+                return OBJ_VAL(externalString(vm, "map", 3));
             case OBJ_NATIVE:
-                return OBJ_VAL(copyString(vm, "native", 6));
+                return OBJ_VAL(externalString(vm, "native", 6));
             default:
                 break;
         }
     }
 
-    return OBJ_VAL(copyString(vm, "Unknown Type", 12));
+    return OBJ_VAL(externalString(vm, "Unknown Type", 12));
+}
+
+/**
+ * Creates a Float64Array, either of the given length filled with zeroes or
+ * holding the numbers in the given list.
+ */
+static Value float64ArrayNative(GhostVM *vm, int argCount, Value *args)
+{
+    if (argCount != 1)
+    {
+        runtimeError(vm, "Float64Array() takes 1 argument (%d given).", argCount);
+        return NULL_VAL;
+    }
+
+    if (IS_NUMBER(args[0]))
+    {
+        double length = AS_NUMBER(args[0]);
+
+        if (length < 0 || length > INT32_MAX / sizeof(double) || length != floor(length))
+        {
+            runtimeError(vm, "Float64Array() length must be a non-negative integer.");
+            return NULL_VAL;
+        }
+
+        return OBJ_VAL(newFloatArray(vm, (int)length));
+    }
+
+    if (IS_LIST(args[0]))
+    {
+        ObjList *list = AS_LIST(args[0]);
+
+        for (int i = 0; i < list->values.count; i++)
+        {
+            if (!IS_NUMBER(list->values.values[i]))
+            {
+                runtimeError(vm, "Float64Array() expects a list of numbers.");
+                return NULL_VAL;
+            }
+        }
+
+        // The list stays reachable through [args] while the array is created.
+        ObjFloatArray *array = newFloatArray(vm, list->values.count);
+
+        for (int i = 0; i < list->values.count; i++)
+        {
+            array->values[i] = AS_NUMBER(list->values.values[i]);
+        }
+
+        return OBJ_VAL(array);
+    }
+
+    runtimeError(vm, "Float64Array() expects a length or a list of numbers.");
+    return NULL_VAL;
 }
 
 /**
@@ -247,6 +295,7 @@ const char *nativeNames[] = {
     "isObject",
     "isString",
     "isList",
+    "Float64Array",
 };
 
 NativeFn nativeFunctions[] = {
@@ -262,6 +311,7 @@ NativeFn nativeFunctions[] = {
     isObjectNative,
     isStringNative,
     isListNative,
+    float64ArrayNative,
 };
 
 void defineAllNatives(GhostVM *vm) {
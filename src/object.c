@@ -12,12 +12,17 @@
     (type*)allocateObject(vm, sizeof(type), objectType)
 
 static Obj* allocateObject(GhostVM *vm, size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(vm, NULL, 0, size);
+    Obj* object = (Obj*)allocateObjectMemory(vm, size);
     object->type = type;
     object->isMarked = false;
+    object->isRemembered = false;
 
-    object->next = vm->objects;
-    vm->objects = object;
+    object->next = vm->youngObjects;
+    vm->youngObjects = object;
+
+    // Objects created while a collection is marking start out gray, so they
+    // are traced once their constructor has filled them in.
+    if (vm->gcPhase == GC_PHASE_MARK) markObject(vm, object);
 
     #if DEBUG_LOG_GC
         printf("%p allocate %ld for %d\n", (void*)object, size, type);
@@ -39,6 +44,8 @@ ObjClass* newClass(GhostVM *vm, ObjString* name) {
     ObjClass* klass = ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
     klass->name = name;
     initTable(&klass->methods);
+    klass->version = ++vm->classVersion;
+    klass->fieldCount = 0;
     return klass;
 }
 
@@ -67,19 +74,109 @@ ObjFunction* newFunction(GhostVM *vm) {
 
     function->arity = 0;
     function->upvalueCount = 0;
+    function->slotCount = 0;
     function->name = NULL;
+    function->hotness = 0;
+    function->jitCode = NULL;
     initChunk(&function->chunk);
 
     return function;
 }
 
 ObjInstance* newInstance(GhostVM *vm, ObjClass* klass) {
-    ObjInstance* instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    int inlineCapacity = klass->fieldCount;
+
+    ObjInstance* instance = (ObjInstance*)allocateObject(vm,
+        sizeof(ObjInstance) + sizeof(Value) * inlineCapacity, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->shape = vm->shapes[0];
+    instance->dictionary = NULL;
+    instance->overflow = NULL;
+    instance->overflowCapacity = 0;
+    instance->inlineCapacity = inlineCapacity;
     return instance;
 }
 
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value) {
+    if (instance->shape == NULL) {
+        return tableGet(instance->dictionary, name, value);
+    }
+
+    int slot = shapeFindSlot(instance->shape, name);
+    if (slot == -1) return false;
+
+    *value = *instanceField(instance, slot);
+    return true;
+}
+
+// Moves [instance] to [shape], which must be the shape reached from its
+// current one by adding a single field, and stores [value] in the new slot.
+void instanceAddField(GhostVM *vm, ObjInstance* instance, Shape* shape, Value value) {
+    int slot = instance->shape->fieldCount;
+    int overflowSlot = slot - instance->inlineCapacity;
+
+    if (overflowSlot >= instance->overflowCapacity) {
+        int oldCapacity = instance->overflowCapacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        instance->overflow = GROW_ARRAY(vm, instance->overflow, Value, oldCapacity, capacity);
+        instance->overflowCapacity = capacity;
+    }
+
+    *instanceField(instance, slot) = value;
+    instance->shape = shape;
+    writeBarrier(vm, (Obj*)instance, value);
+
+    if (shape->fieldCount > instance->klass->fieldCount) {
+        instance->klass->fieldCount = shape->fieldCount;
+    }
+}
+
+// Stops using shapes for [instance] and copies its fields into a Table.
+static void instanceToDictionary(GhostVM *vm, ObjInstance* instance) {
+    Shape* shape = instance->shape;
+
+    instance->dictionary = ALLOCATE(vm, Table, 1);
+    initTable(instance->dictionary);
+
+    for (int i = 0; i <= shape->slots.capacity; i++) {
+        Entry* entry = &shape->slots.entries[i];
+        if (entry->key == NULL) continue;
+
+        Value value = *instanceField(instance, (int)AS_NUMBER(entry->value));
+        tableSet(vm, instance->dictionary, entry->key, value);
+    }
+
+    instance->shape = NULL;
+    FREE_ARRAY(vm, Value, instance->overflow, instance->overflowCapacity);
+    instance->overflow = NULL;
+    instance->overflowCapacity = 0;
+}
+
+void instanceSetField(GhostVM *vm, ObjInstance* instance, ObjString* name, Value value) {
+    if (instance->shape != NULL) {
+        int slot = shapeFindSlot(instance->shape, name);
+
+        if (slot != -1) {
+            *instanceField(instance, slot) = value;
+            writeBarrier(vm, (Obj*)instance, value);
+            return;
+        }
+
+        Shape* next = shapeTransition(vm, instance->shape, name);
+
+        if (next != NULL) {
+            instanceAddField(vm, instance, next, value);
+            return;
+        }
+
+        instanceToDictionary(vm, instance);
+    }
+
+    tableSet(vm, instance->dictionary, name, value);
+    writeBarrier(vm, (Obj*)instance, OBJ_VAL(name));
+    writeBarrier(vm, (Obj*)instance, value);
+}
+
 ObjNative* newNative(GhostVM *vm, NativeFn function) {
     ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
     native->function = function;
@@ -94,12 +191,39 @@ ObjList* newList(GhostVM *vm) {
     return list;
 }
 
-static ObjString* allocateString(GhostVM *vm, char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
+ObjMap* newMap(GhostVM *vm) {
+    ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    map->count = 0;
+    map->capacity = 0;
+    map->entries = NULL;
+
+    return map;
+}
+
+ObjModule* newModule(GhostVM *vm, ObjString* path) {
+    ObjModule* module = ALLOCATE_OBJ(vm, ObjModule, OBJ_MODULE);
+    module->path = path;
+    module->function = NULL;
+    module->modified = 0;
+    module->size = 0;
+    module->executed = false;
+
+    return module;
+}
+
+// Creates a string of [length] characters for the caller to fill in. It must
+// be passed to internString() before anything else is allocated.
+ObjString* newString(GhostVM *vm, int length) {
+    ObjString* string = (ObjString*)allocateObject(vm,
+        sizeof(ObjString) + length + 1, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
-    string->hash = hash;
+    string->chars = string->inlineChars;
+    string->chars[length] = '\0';
 
+    return string;
+}
+
+static ObjString* addInterned(GhostVM *vm, ObjString* string) {
     push(vm, OBJ_VAL(string));
     tableSet(vm, &vm->strings, string, NULL_VAL);
     pop(vm);
@@ -107,11 +231,45 @@ static ObjString* allocateString(GhostVM *vm, char* chars, int length, uint32_t
     return string;
 }
 
+// Strings at least this long are hashed eight bytes at a time.
+#define HASH_WORD_THRESHOLD 16
+
+// Hashes a long string one 64-bit word per step, multiplying each word into
+// the state and folding the high half back down. The last partial word is
+// zero padded, and a final avalanche spreads every byte into the low bits the
+// tables index with.
+static uint32_t hashWords(const char* key, int length) {
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ (uint64_t)length;
+    uint64_t word;
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        memcpy(&word, key + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+        hash ^= hash >> 32;
+    }
+
+    if (i < length) {
+        word = 0;
+        memcpy(&word, key + i, length - i);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+    }
+
+    hash ^= hash >> 29;
+    hash *= 0xc4ceb9fe1a85ec53u;
+    hash ^= hash >> 32;
+
+    return (uint32_t)hash;
+}
+
 // The hashString function utilizes the FNV-1a algorithm to
 // create a unique and reproducable hash of the given key
 // with the given length. "FNV" stands for "Fowler/Noll/Vo",
-// named after the creators of the algorithm.
+// named after the creators of the algorithm. Long strings,
+// where a byte at a time gets slow, use hashWords() instead.
 static uint32_t hashString(const char* key, int length) {
+    if (length >= HASH_WORD_THRESHOLD) return hashWords(key, length);
+
     // we are implementing a 32bit hash, so the hash and prime
     // values are set appropriately for this size.
     uint32_t hash = 2166136261u;
@@ -125,29 +283,117 @@ static uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
-ObjString* takeString(GhostVM *vm, char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+// Looks up an existing string with the given contents.
+static ObjString* findInterned(GhostVM *vm, const char* chars, int length, uint32_t hash) {
     ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
 
+    // While sweeping, an unmarked string may be garbage that just hasn't been
+    // freed yet. Mark it so it survives being handed out again.
+    if (interned != NULL && vm->gcPhase == GC_PHASE_SWEEP) {
+        interned->obj.isMarked = true;
+    }
+
+    return interned;
+}
+
+// Returns the interned string equal to [string], which came from
+// newString(). If there already is one, [string] is freed.
+ObjString* internString(GhostVM *vm, ObjString* string) {
+    string->hash = hashString(string->chars, string->length);
+    ObjString* interned = findInterned(vm, string->chars, string->length, string->hash);
+
     if (interned != NULL) {
-        FREE_ARRAY(vm, char, chars, length + 1);
+        // Nothing has been allocated since [string], so it is still the head
+        // of the young list and nothing else refers to it. Freeing it now
+        // saves the collector a sweep and a string table probe.
+        vm->youngObjects = string->obj.next;
+        freeObjectMemory(vm, string, sizeof(ObjString) + string->length + 1);
         return interned;
     }
 
-    return allocateString(vm, chars, length, hash);
+    return addInterned(vm, string);
 }
 
 ObjString* copyString(GhostVM *vm, const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
+
+    if (interned != NULL) return interned;
+
+    ObjString* string = newString(vm, length);
+    memcpy(string->chars, chars, length);
+    string->hash = hash;
+
+    return addInterned(vm, string);
+}
+
+// Returns a string whose characters are [chars], without copying them. They
+// must be followed by a '\0' and outlive the VM, such as a C string literal
+// or a file mapped into memory for the VM's lifetime.
+ObjString* externalString(GhostVM *vm, const char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = findInterned(vm, chars, length, hash);
 
     if (interned != NULL) return interned;
 
-    char* heapChars = ALLOCATE(vm, char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
+    ObjString* string = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
+    string->length = length;
+    string->hash = hash;
+    string->chars = (char*)chars;
+
+    return addInterned(vm, string);
+}
+
+// Creates an array of [count] zeroes.
+ObjFloatArray* newFloatArray(GhostVM *vm, int count) {
+    ObjFloatArray* array = (ObjFloatArray*)allocateObject(vm,
+        sizeof(ObjFloatArray) + sizeof(double) * count, OBJ_FLOAT_ARRAY);
+    array->count = count;
+
+    for (int i = 0; i < count; i++) {
+        array->values[i] = 0;
+    }
+
+    return array;
+}
+
+ObjStringBuffer* newStringBuffer(GhostVM *vm) {
+    ObjStringBuffer* buffer = ALLOCATE_OBJ(vm, ObjStringBuffer, OBJ_STRING_BUFFER);
+    buffer->count = 0;
+    buffer->capacity = 0;
+    buffer->chars = NULL;
+    return buffer;
+}
+
+// Makes room for at least [capacity] characters in [buffer], which the
+// caller keeps reachable. This may move the characters.
+void reserveStringBuffer(GhostVM *vm, ObjStringBuffer* buffer, int capacity) {
+    if (capacity <= buffer->capacity) return;
+
+    int newCapacity = GROW_CAPACITY(buffer->capacity);
+    if (newCapacity < capacity) newCapacity = capacity;
+
+    buffer->chars = GROW_ARRAY(vm, buffer->chars, char, buffer->capacity, newCapacity);
+    buffer->capacity = newCapacity;
+}
+
+ObjLazyString* newLazyString(GhostVM *vm, ObjStringBuffer* buffer, int length) {
+    ObjLazyString* string = ALLOCATE_OBJ(vm, ObjLazyString, OBJ_LAZY_STRING);
+    string->length = length;
+    string->buffer = buffer;
+    string->flattened = NULL;
+    return string;
+}
+
+// Returns the interned string with the same characters as [string], which
+// the caller keeps reachable.
+ObjString* flattenString(GhostVM *vm, ObjLazyString* string) {
+    if (string->flattened == NULL) {
+        string->flattened = copyString(vm, string->buffer->chars, string->length);
+        writeBarrier(vm, (Obj*)string, OBJ_VAL(string->flattened));
+    }
 
-    return allocateString(vm, heapChars, length, hash);
+    return string->flattened;
 }
 
 ObjUpvalue* newUpvalue(GhostVM *vm, Value* slot) {
@@ -212,6 +458,58 @@ void printObject(Value value) {
             break;
         }
 
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray* array = AS_FLOAT_ARRAY(value);
+            printf("[");
+
+            for (int i = 0; i < array->count; ++i) {
+                printValue(NUMBER_VAL(array->values[i]));
+
+                if (i != array->count - 1) {
+                    printf(", ");
+                }
+            }
+
+            printf("]");
+            break;
+        }
+
+        case OBJ_MAP: {
+            ObjMap* map = AS_MAP(value);
+            int printed = 0;
+            printf("{");
+
+            for (int i = 0; i < map->capacity; ++i) {
+                MapEntry* entry = &map->entries[i];
+                if (entry->distance == 0) continue;
+
+                printValue(entry->key);
+                printf(": ");
+                printValue(entry->value);
+
+                if (++printed != map->count) {
+                    printf(", ");
+                }
+            }
+
+            printf("}");
+            break;
+        }
+
+        case OBJ_LAZY_STRING: {
+            ObjLazyString* string = AS_LAZY_STRING(value);
+            printf("%.*s", string->length, string->buffer->chars);
+            break;
+        }
+
+        case OBJ_STRING_BUFFER:
+            printf("string buffer");
+            break;
+
+        case OBJ_MODULE:
+            printf("<module %s>", AS_MODULE(value)->path->chars);
+            break;
+
         case OBJ_UPVALUE:
             printf("upvalue");
             break;
@@ -4,6 +4,7 @@
 #include "include/ghost.h"
 #include "common.h"
 #include "chunk.h"
+#include "shape.h"
 #include "table.h"
 #include "value.h"
 
@@ -18,6 +19,10 @@
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
 #define IS_LIST(value)         isObjType(value, OBJ_LIST)
+#define IS_LAZY_STRING(value)  isObjType(value, OBJ_LAZY_STRING)
+#define IS_FLOAT_ARRAY(value)  isObjType(value, OBJ_FLOAT_ARRAY)
+#define IS_MAP(value)          isObjType(value, OBJ_MAP)
+#define IS_MODULE(value)       isObjType(value, OBJ_MODULE)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
@@ -29,6 +34,10 @@
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 #define AS_LIST(value)         ((ObjList*)AS_OBJ(value))
+#define AS_LAZY_STRING(value)  ((ObjLazyString*)AS_OBJ(value))
+#define AS_FLOAT_ARRAY(value)  ((ObjFloatArray*)AS_OBJ(value))
+#define AS_MAP(value)          ((ObjMap*)AS_OBJ(value))
+#define AS_MODULE(value)       ((ObjModule*)AS_OBJ(value))
 
 typedef enum {
     OBJ_BOUND_METHOD,
@@ -40,12 +49,21 @@ typedef enum {
     OBJ_NATIVE,
     OBJ_STRING,
     OBJ_LIST,
+    OBJ_LAZY_STRING,
+    OBJ_STRING_BUFFER,
+    OBJ_FLOAT_ARRAY,
+    OBJ_MAP,
+    OBJ_MODULE,
     OBJ_UPVALUE
 } ObjType;
 
 struct sObj {
     ObjType type;
     bool isMarked;
+
+    // Whether the object is queued to be traced again after being given a
+    // reference by the write barrier. See rememberObject().
+    bool isRemembered;
     struct sObj* next;
 };
 
@@ -53,8 +71,17 @@ typedef struct {
     Obj obj;
     int arity;
     int upvalueCount;
+
+    // The most values the function has on the stack at once, its locals and
+    // temporaries included, which the VM makes room for before calling it.
+    int slotCount;
     Chunk chunk;
     ObjString* name;
+
+    // How often the function has been called or looped since it was
+    // created, and its machine code once that reaches the JIT threshold.
+    int hotness;
+    struct sJitCode* jitCode;
 } ObjFunction;
 
 typedef Value (*NativeFn)(GhostVM *vm, int argCount, Value* args);
@@ -64,18 +91,88 @@ typedef struct {
   NativeFn function;
 } ObjNative;
 
+// A string's characters are normally stored right after it, in the same
+// allocation. Strings created by externalString() instead point at bytes
+// owned by the host, which are never copied or freed.
 struct sObjString {
     Obj obj;
     int length;
-    char* chars;
     uint32_t hash;
+    char* chars;
+    char inlineChars[];
 };
 
+// Growable character storage shared by lazy strings. It is never seen by
+// scripts, and its characters are not '\0' terminated.
+typedef struct {
+    Obj obj;
+    int count;
+    int capacity;
+    char* chars;
+} ObjStringBuffer;
+
+// The result of a long concatenation: the first [length] characters of
+// [buffer]. Appending to the lazy string that ends at the buffer's count
+// writes into the same buffer, so building a string piece by piece costs
+// amortized constant time per piece instead of copying it every time.
+//
+// Scripts see lazy strings as ordinary strings. The VM flattens them into
+// interned ObjStrings wherever a string's identity or characters are
+// needed, and caches the result in [flattened].
+typedef struct {
+    Obj obj;
+    int length;
+    ObjStringBuffer* buffer;
+    ObjString* flattened;
+} ObjLazyString;
+
 typedef struct sObjList {
     Obj obj;
     ValueArray values;
 } ObjList;
 
+// A fixed length array of unboxed doubles, stored right after the header.
+typedef struct {
+    Obj obj;
+    int count;
+    double values[];
+} ObjFloatArray;
+
+typedef struct {
+    Value key;
+    Value value;
+    uint32_t hash;
+
+    // One more than how far the entry sits from the slot its hash selects,
+    // or zero if the slot is empty.
+    uint32_t distance;
+} MapEntry;
+
+// A hash table from any value to any value, using Robin Hood probing. See
+// datatypes/map.c.
+typedef struct {
+    Obj obj;
+    int count;
+    int capacity;
+    MapEntry* entries;
+} ObjMap;
+
+// A source file pulled in by include or import. See module.c.
+typedef struct {
+    Obj obj;
+    ObjString* path;
+
+    // The file's compiled body, and the modification time and size of the
+    // file it was compiled from.
+    ObjFunction* function;
+    int64_t modified;
+    int64_t size;
+
+    // Whether the body has started running, which import only lets happen
+    // once.
+    bool executed;
+} ObjModule;
+
 typedef struct sUpvalue {
     Obj obj;
     Value* location;
@@ -94,6 +191,14 @@ typedef struct sObjClass {
     Obj obj;
     ObjString* name;
     Table methods;
+
+    // Unique across the VM and replaced whenever [methods] changes, so inline
+    // caches keyed on it can never match a stale or reused class.
+    uint64_t version;
+
+    // The most fields any instance of this class has had so far. New
+    // instances reserve this many inline slots up front.
+    int fieldCount;
 } ObjClass;
 
 typedef struct sObjNativeClass {
@@ -105,7 +210,19 @@ typedef struct sObjNativeClass {
 typedef struct {
     Obj obj;
     ObjClass* klass;
-    Table fields;
+
+    // Describes which slot holds each field. NULL once the instance has
+    // fallen off the shape tree and keeps its fields in [dictionary] instead,
+    // which is only allocated then.
+    Shape* shape;
+    Table* dictionary;
+
+    // The first [inlineCapacity] field slots are stored right after the
+    // header. Any further slots spill over into [overflow].
+    Value* overflow;
+    int overflowCapacity;
+    int inlineCapacity;
+    Value slots[];
 } ObjInstance;
 
 typedef struct {
@@ -120,10 +237,22 @@ ObjNativeClass *newNativeClass(GhostVM *vm, ObjString *name);
 ObjClosure *newClosure(GhostVM *vm, ObjFunction *function);
 ObjFunction *newFunction(GhostVM *vm);
 ObjInstance *newInstance(GhostVM *vm, ObjClass *klass);
+bool instanceGetField(ObjInstance *instance, ObjString *name, Value *value);
+void instanceSetField(GhostVM *vm, ObjInstance *instance, ObjString *name, Value value);
+void instanceAddField(GhostVM *vm, ObjInstance *instance, Shape *shape, Value value);
 ObjNative *newNative(GhostVM *vm, NativeFn function);
-ObjString *takeString(GhostVM *vm, char *chars, int length);
+ObjString *newString(GhostVM *vm, int length);
+ObjString *internString(GhostVM *vm, ObjString *string);
 ObjString *copyString(GhostVM *vm, const char *chars, int length);
+ObjString *externalString(GhostVM *vm, const char *chars, int length);
+ObjStringBuffer *newStringBuffer(GhostVM *vm);
+void reserveStringBuffer(GhostVM *vm, ObjStringBuffer *buffer, int capacity);
+ObjLazyString *newLazyString(GhostVM *vm, ObjStringBuffer *buffer, int length);
+ObjString *flattenString(GhostVM *vm, ObjLazyString *string);
 ObjList *newList(GhostVM *vm);
+ObjFloatArray *newFloatArray(GhostVM *vm, int count);
+ObjMap *newMap(GhostVM *vm);
+ObjModule *newModule(GhostVM *vm, ObjString *path);
 ObjUpvalue *newUpvalue(GhostVM *vm, Value *slot);
 void printObject(Value value);
 
@@ -135,4 +264,11 @@ static inline ObjType getObjType(Value value) {
     return AS_OBJ(value)->type;
 }
 
+// Returns the storage for field [slot] of an instance that has a shape.
+static inline Value* instanceField(ObjInstance* instance, int slot) {
+    if (slot < instance->inlineCapacity) return &instance->slots[slot];
+
+    return &instance->overflow[slot - instance->inlineCapacity];
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+// This defines the bytecodes used by the Ghost virtual machine. It is an
+// "X-macro" file: include it after defining OPCODE(name) to generate code
+// for every instruction. The order here determines the numeric value of each
+// opcode, so the OpCode enum and the VM's dispatch table always agree.
+
+OPCODE(CONSTANT)
+OPCODE(NULL)
+OPCODE(TRUE)
+OPCODE(FALSE)
+OPCODE(NEW_LIST)
+OPCODE(ADD_LIST)
+OPCODE(NEW_MAP)
+OPCODE(ADD_MAP)
+OPCODE(SUBSCRIPT)
+OPCODE(SUBSCRIPT_ASSIGN)
+OPCODE(POP)
+OPCODE(GET_LOCAL)
+OPCODE(SET_LOCAL)
+OPCODE(GET_GLOBAL)
+OPCODE(DEFINE_GLOBAL)
+OPCODE(SET_GLOBAL)
+OPCODE(GET_UPVALUE)
+OPCODE(SET_UPVALUE)
+OPCODE(GET_PROPERTY)
+OPCODE(SET_PROPERTY)
+OPCODE(GET_SUPER)
+OPCODE(EQUAL)
+OPCODE(GREATER)
+OPCODE(LESS)
+OPCODE(NOT_EQUAL)
+OPCODE(GREATER_EQUAL)
+OPCODE(LESS_EQUAL)
+OPCODE(ADD)
+OPCODE(SUBTRACT)
+OPCODE(MULTIPLY)
+OPCODE(DIVIDE)
+OPCODE(MODULO)
+OPCODE(NOT)
+OPCODE(NEGATE)
+OPCODE(JUMP)
+OPCODE(JUMP_IF_FALSE)
+OPCODE(JUMP_IF_TRUE)
+OPCODE(LOOP)
+OPCODE(CALL)
+OPCODE(TAIL_CALL)
+OPCODE(INVOKE)
+OPCODE(SUPER_INVOKE)
+OPCODE(CLOSURE)
+OPCODE(CLOSE_UPVALUE)
+OPCODE(RETURN)
+OPCODE(CLASS)
+OPCODE(INHERIT)
+OPCODE(METHOD)
+OPCODE(INCLUDE)
+OPCODE(IMPORT)
+
+// Superinstructions. The compiler never emits these itself; the optimizer
+// fuses them from the sequences they stand for.
+OPCODE(GET_LOCAL_GET_LOCAL)
+OPCODE(SET_LOCAL_POP)
+OPCODE(ADD_LOCAL_CONST)
+OPCODE(SUBTRACT_LOCAL_CONST)
+OPCODE(LESS_LOCAL_CONST_JUMP)
+OPCODE(GREATER_LOCAL_CONST_JUMP)
+OPCODE(RETURN_LOCAL)
+
+// Quickened instructions. The VM rewrites the generic arithmetic and
+// comparison instructions into these in place once they have seen two
+// numbers, and back again when they see anything else.
+OPCODE(ADD_NUM)
+OPCODE(SUBTRACT_NUM)
+OPCODE(MULTIPLY_NUM)
+OPCODE(DIVIDE_NUM)
+OPCODE(GREATER_NUM)
+OPCODE(LESS_NUM)
+OPCODE(GREATER_EQUAL_NUM)
+OPCODE(LESS_EQUAL_NUM)
+
+// Wide forms, which the compiler emits only once an operand outgrows a single
+// byte: a three byte constant index, or a two byte local slot.
+OPCODE(CONSTANT_LONG)
+OPCODE(GET_LOCAL_LONG)
+OPCODE(SET_LOCAL_LONG)
+OPCODE(GET_PROPERTY_LONG)
+OPCODE(SET_PROPERTY_LONG)
+OPCODE(GET_SUPER_LONG)
+OPCODE(INVOKE_LONG)
+OPCODE(SUPER_INVOKE_LONG)
+OPCODE(CLOSURE_LONG)
+OPCODE(CLASS_LONG)
+OPCODE(METHOD_LONG)
\ No newline at end of file
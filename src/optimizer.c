@@ -0,0 +1,682 @@
+#include <math.h>
+#include <string.h>
+
+#include "include/ghost.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "vm.h"
+
+// The optimizer works on a decoded copy of the chunk with one entry per
+// instruction, where jumps point at the instruction they land on instead of
+// at a byte offset. Instructions can then be removed or rewritten without
+// fixing up offsets along the way. Once nothing more can be simplified the
+// instructions are encoded back into the chunk. No rewrite makes an
+// instruction longer, so the code only ever shrinks and fits where it was.
+//
+// Once the code is as simple as it gets, sequences of instructions that
+// dominate typical loops and calls are replaced by superinstructions, which
+// do the work of the whole sequence in one dispatch.
+
+typedef struct {
+    // Where the instruction starts in the original code, and its length
+    // there.
+    int offset;
+    int length;
+    int line;
+
+    uint8_t op;
+
+    // The first two operand bytes, not counting jump offsets.
+    uint8_t operands[2];
+
+    // Set once [op] no longer matches the original bytes, which are then
+    // ignored when encoding. Only instructions with at most two operands
+    // besides a jump offset are ever rewritten.
+    bool rewritten;
+    bool removed;
+
+    // For jumps, the index of the instruction landed on.
+    int target;
+
+    // How many jumps land on this instruction.
+    int jumpsIn;
+} Instruction;
+
+typedef struct {
+    GhostVM *vm;
+    ObjFunction* function;
+
+    Instruction* instructions;
+    int count;
+} Optimizer;
+
+static bool isJump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_LESS_LOCAL_CONST_JUMP:
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Jumps that test the value on top of the stack, without popping it.
+static bool isTestJump(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+// Conditional jumps only ever go forwards.
+static bool isConditionalJump(uint8_t op) {
+    return isJump(op) && op != OP_JUMP && op != OP_LOOP;
+}
+
+// Whether execution never continues with the next instruction.
+static bool isUnconditional(uint8_t op) {
+    return op == OP_RETURN || op == OP_RETURN_LOCAL || op == OP_JUMP || op == OP_LOOP;
+}
+
+// The number of operand bytes of an instruction the optimizer rewrote, not
+// counting any jump offset.
+static int operandCount(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_SET_LOCAL_POP:
+        case OP_RETURN_LOCAL:
+            return 1;
+
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUBTRACT_LOCAL_CONST:
+        case OP_GET_LOCAL_GET_LOCAL:
+        case OP_LESS_LOCAL_CONST_JUMP:
+        case OP_GREATER_LOCAL_CONST_JUMP:
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+// Returns the index of the first instruction still present at or after
+// [index], or -1 if there is none.
+static int resolve(Optimizer* optimizer, int index) {
+    while (index < optimizer->count && optimizer->instructions[index].removed) index++;
+
+    return index < optimizer->count ? index : -1;
+}
+
+static int nextInstruction(Optimizer* optimizer, int index) {
+    return resolve(optimizer, index + 1);
+}
+
+static int previousInstruction(Optimizer* optimizer, int index) {
+    index--;
+    while (index >= 0 && optimizer->instructions[index].removed) index--;
+
+    return index;
+}
+
+// Returns the index of the instruction the jump at [index] lands on, pointing
+// the jump straight at it if what it used to land on has been removed since.
+static int jumpTarget(Optimizer* optimizer, int index) {
+    Instruction* jump = &optimizer->instructions[index];
+    jump->target = resolve(optimizer, jump->target);
+
+    return jump->target;
+}
+
+// Points every jump at an instruction that is still present and recounts how
+// many jumps land on each instruction. The rewrites keep the counts up to
+// date as they go, so this is only needed before the first and after the
+// last.
+static void countJumps(Optimizer* optimizer) {
+    for (int i = 0; i < optimizer->count; i++) {
+        optimizer->instructions[i].jumpsIn = 0;
+    }
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction* instruction = &optimizer->instructions[i];
+        if (instruction->removed || !isJump(instruction->op)) continue;
+
+        instruction->target = resolve(optimizer, instruction->target);
+        optimizer->instructions[instruction->target].jumpsIn++;
+    }
+}
+
+// Removes the instruction at [index]. Jumps that landed on it now land on the
+// instruction after it, which takes over its count.
+static void removeInstruction(Optimizer* optimizer, int index) {
+    Instruction* instruction = &optimizer->instructions[index];
+
+    if (isJump(instruction->op)) {
+        optimizer->instructions[jumpTarget(optimizer, index)].jumpsIn--;
+    }
+
+    instruction->removed = true;
+
+    int next = nextInstruction(optimizer, index);
+    if (next != -1) optimizer->instructions[next].jumpsIn += instruction->jumpsIn;
+    instruction->jumpsIn = 0;
+}
+
+static void rewrite(Instruction* instruction, uint8_t op) {
+    instruction->op = op;
+    instruction->rewritten = true;
+}
+
+static bool literalValue(Optimizer* optimizer, Instruction* instruction, Value* value) {
+    switch (instruction->op) {
+        case OP_CONSTANT:
+            *value = optimizer->function->chunk.constants.values[instruction->operands[0]];
+            return true;
+        case OP_NULL: *value = NULL_VAL; return true;
+        case OP_TRUE: *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        default: return false;
+    }
+}
+
+static bool identical(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+
+    return IS_OBJ(a) && IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b);
+}
+
+// Turns [instruction] into one that pushes [value]. Fails if [value] needs a
+// new constant and the chunk has no room left for one.
+static bool makeLiteral(Optimizer* optimizer, Instruction* instruction, Value value) {
+    if (IS_NULL(value)) {
+        rewrite(instruction, OP_NULL);
+        return true;
+    }
+
+    if (IS_BOOL(value)) {
+        rewrite(instruction, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+        return true;
+    }
+
+    ValueArray* constants = &optimizer->function->chunk.constants;
+    int constant = 0;
+
+    // Only the first 256 constants fit OP_CONSTANT's operand, so there is no
+    // point searching a large table any further.
+    while (constant < constants->count && constant <= UINT8_MAX &&
+           !identical(constants->values[constant], value)) {
+        constant++;
+    }
+
+    if (constant > UINT8_MAX) return false;
+
+    if (constant == constants->count) {
+        addConstant(optimizer->vm, &optimizer->function->chunk, value);
+        writeBarrier(optimizer->vm, (Obj*)optimizer->function, value);
+    }
+
+    rewrite(instruction, OP_CONSTANT);
+    instruction->operands[0] = (uint8_t)constant;
+
+    return true;
+}
+
+static Value concatenateConstants(GhostVM *vm, ObjString* a, ObjString* b) {
+    ObjString* result = newString(vm, a->length + b->length);
+    memcpy(result->chars, a->chars, a->length);
+    memcpy(result->chars + a->length, b->chars, b->length);
+
+    return OBJ_VAL(internString(vm, result));
+}
+
+// Evaluates [op] on two constant operands the way the VM would. Fails for
+// operands the VM would report a runtime error for, so that the error still
+// happens when the code runs.
+static bool foldBinary(Optimizer* optimizer, uint8_t op, Value a, Value b, Value* result) {
+    switch (op) {
+        case OP_EQUAL: *result = BOOL_VAL(valuesEqual(a, b)); return true;
+        case OP_NOT_EQUAL: *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+
+        case OP_ADD:
+            if (IS_STRING(a) && IS_STRING(b)) {
+                *result = concatenateConstants(optimizer->vm, AS_STRING(a), AS_STRING(b));
+                return true;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (op) {
+        case OP_ADD: *result = NUMBER_VAL(x + y); return true;
+        case OP_SUBTRACT: *result = NUMBER_VAL(x - y); return true;
+        case OP_MULTIPLY: *result = NUMBER_VAL(x * y); return true;
+        case OP_DIVIDE: *result = NUMBER_VAL(x / y); return true;
+        case OP_MODULO: *result = NUMBER_VAL(fmod(x, y)); return true;
+        case OP_GREATER: *result = BOOL_VAL(x > y); return true;
+        case OP_LESS: *result = BOOL_VAL(x < y); return true;
+        case OP_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+        case OP_LESS_EQUAL: *result = BOOL_VAL(!(x > y)); return true;
+        default: return false;
+    }
+}
+
+static bool foldUnary(uint8_t op, Value value, Value* result) {
+    switch (op) {
+        case OP_NOT:
+            *result = BOOL_VAL(isFalsey(value));
+            return true;
+
+        case OP_NEGATE:
+            if (!IS_NUMBER(value)) return false;
+
+            *result = NUMBER_VAL(-AS_NUMBER(value));
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Returns the comparison that gives the opposite answer to [op], or
+// OP_RETURN if [op] is not a comparison. OP_GREATER_EQUAL is defined as the
+// negation of OP_LESS, not in terms of OP_GREATER, so that comparisons with
+// NaN behave the same either way.
+static uint8_t negatedComparison(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL: return OP_NOT_EQUAL;
+        case OP_NOT_EQUAL: return OP_EQUAL;
+        case OP_LESS: return OP_GREATER_EQUAL;
+        case OP_GREATER_EQUAL: return OP_LESS;
+        case OP_GREATER: return OP_LESS_EQUAL;
+        case OP_LESS_EQUAL: return OP_GREATER;
+        default: return OP_RETURN;
+    }
+}
+
+// Points the jump at [index] past any unconditional jump it lands on.
+static bool threadJump(Optimizer* optimizer, int index) {
+    Instruction* jump = &optimizer->instructions[index];
+    int landing = jumpTarget(optimizer, index);
+    Instruction* target = &optimizer->instructions[landing];
+
+    if (target->op != OP_JUMP && target->op != OP_LOOP) return false;
+
+    int destination = jumpTarget(optimizer, landing);
+    if (destination == landing) return false;
+
+    // Conditional jumps only go forwards.
+    if (isConditionalJump(jump->op) && destination <= index) return false;
+
+    // The code only shrinks, so a jump that fits in the original code fits in
+    // the optimized one.
+    int distance = optimizer->instructions[destination].offset - (jump->offset + jump->length);
+    if (distance > UINT16_MAX || distance < -UINT16_MAX) return false;
+
+    jump->target = destination;
+    target->jumpsIn--;
+    optimizer->instructions[destination].jumpsIn++;
+
+    return true;
+}
+
+// Tries each rewrite on the instruction at [index] and the ones following it,
+// stopping at the first that applies.
+static bool simplifyAt(Optimizer* optimizer, int index) {
+    Instruction* instructions = optimizer->instructions;
+    Instruction* a = &instructions[index];
+
+    int next = nextInstruction(optimizer, index);
+    if (next == -1) return false;
+
+    Instruction* b = &instructions[next];
+
+    // Code after an unconditional jump or return that is not jumped to can
+    // never run.
+    if (isUnconditional(a->op) && b->jumpsIn == 0) {
+        for (int i = next; i != -1 && instructions[i].jumpsIn == 0; i = nextInstruction(optimizer, i)) {
+            removeInstruction(optimizer, i);
+        }
+
+        return true;
+    }
+
+    if (isJump(a->op)) {
+        if (threadJump(optimizer, index)) return true;
+
+        // A jump to the next instruction does nothing.
+        if ((a->op == OP_JUMP || isTestJump(a->op)) && jumpTarget(optimizer, index) == next) {
+            removeInstruction(optimizer, index);
+            return true;
+        }
+
+        return false;
+    }
+
+    Value value;
+    bool isLiteral = literalValue(optimizer, a, &value);
+
+    if (b->jumpsIn > 0) return false;
+
+    // Pushing something free of side effects only to pop it again.
+    if (b->op == OP_POP && (isLiteral || a->op == OP_GET_LOCAL || a->op == OP_GET_UPVALUE)) {
+        removeInstruction(optimizer, index);
+        removeInstruction(optimizer, next);
+        return true;
+    }
+
+    if (isLiteral) {
+        Value result;
+
+        if (isTestJump(b->op)) {
+            bool taken = isFalsey(value) == (b->op == OP_JUMP_IF_FALSE);
+
+            if (taken) {
+                rewrite(b, OP_JUMP);
+            } else {
+                removeInstruction(optimizer, next);
+            }
+
+            return true;
+        }
+
+        if (foldUnary(b->op, value, &result)) {
+            if (!makeLiteral(optimizer, a, result)) return false;
+
+            removeInstruction(optimizer, next);
+            return true;
+        }
+
+        Value right;
+        int last = nextInstruction(optimizer, next);
+
+        if (last != -1 && instructions[last].jumpsIn == 0 &&
+            literalValue(optimizer, b, &right) &&
+            foldBinary(optimizer, instructions[last].op, value, right, &result)) {
+            if (!makeLiteral(optimizer, a, result)) return false;
+
+            removeInstruction(optimizer, next);
+            removeInstruction(optimizer, last);
+            return true;
+        }
+
+        return false;
+    }
+
+    if (b->op == OP_NOT && negatedComparison(a->op) != OP_RETURN) {
+        rewrite(a, negatedComparison(a->op));
+        removeInstruction(optimizer, next);
+        return true;
+    }
+
+    // Negating a condition only to test it can test the other way instead,
+    // provided the value is popped on both paths so nothing sees that it was
+    // not negated.
+    if (a->op == OP_NOT && isTestJump(b->op)) {
+        int fallthrough = nextInstruction(optimizer, next);
+
+        if (fallthrough != -1 && instructions[fallthrough].op == OP_POP &&
+            instructions[jumpTarget(optimizer, next)].op == OP_POP) {
+            removeInstruction(optimizer, index);
+            rewrite(b, b->op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Collects the indices of the [length] instructions starting at [index] into
+// [sequence]. Fails if there are not enough, or if anything but the first is
+// jumped to, since then the sequence cannot be replaced as a whole.
+static bool sequenceAt(Optimizer* optimizer, int index, int* sequence, int length) {
+    sequence[0] = index;
+
+    for (int i = 1; i < length; i++) {
+        sequence[i] = nextInstruction(optimizer, sequence[i - 1]);
+        if (sequence[i] == -1 || optimizer->instructions[sequence[i]].jumpsIn > 0) return false;
+    }
+
+    return true;
+}
+
+static bool isNumberConstant(Optimizer* optimizer, Instruction* instruction) {
+    Value value;
+    return literalValue(optimizer, instruction, &value) && IS_NUMBER(value);
+}
+
+// Replaces a local compared against a number and tested by a jump, as in
+// the condition of most loops. The comparison's result never reaches the
+// stack, so the pops following the jump on either path go too. The pop at
+// the target must only be reached by this jump for that to be safe.
+static bool fuseCompareJump(Optimizer* optimizer, int index) {
+    Instruction* instructions = optimizer->instructions;
+    int sequence[5];
+
+    if (!sequenceAt(optimizer, index, sequence, 5)) return false;
+
+    Instruction* local = &instructions[sequence[0]];
+    Instruction* constant = &instructions[sequence[1]];
+    uint8_t comparison = instructions[sequence[2]].op;
+    Instruction* jump = &instructions[sequence[3]];
+
+    if (local->op != OP_GET_LOCAL || !isNumberConstant(optimizer, constant) ||
+        (comparison != OP_LESS && comparison != OP_GREATER) ||
+        jump->op != OP_JUMP_IF_FALSE || instructions[sequence[4]].op != OP_POP) {
+        return false;
+    }
+
+    int landing = jumpTarget(optimizer, sequence[3]);
+    Instruction* target = &instructions[landing];
+    int previous = previousInstruction(optimizer, landing);
+
+    if (target->op != OP_POP || target->jumpsIn != 1 ||
+        previous == -1 || !isUnconditional(instructions[previous].op)) {
+        return false;
+    }
+
+    rewrite(local, comparison == OP_LESS ? OP_LESS_LOCAL_CONST_JUMP : OP_GREATER_LOCAL_CONST_JUMP);
+    local->operands[1] = constant->operands[0];
+    local->target = landing;
+    target->jumpsIn++;
+
+    for (int i = 1; i < 5; i++) removeInstruction(optimizer, sequence[i]);
+    removeInstruction(optimizer, landing);
+
+    return true;
+}
+
+// Replaces a number added to or subtracted from a local.
+static bool fuseLocalConstant(Optimizer* optimizer, int index) {
+    Instruction* instructions = optimizer->instructions;
+    int sequence[3];
+
+    if (!sequenceAt(optimizer, index, sequence, 3)) return false;
+
+    Instruction* local = &instructions[sequence[0]];
+    Instruction* constant = &instructions[sequence[1]];
+    uint8_t op = instructions[sequence[2]].op;
+
+    if (local->op != OP_GET_LOCAL || !isNumberConstant(optimizer, constant) ||
+        (op != OP_ADD && op != OP_SUBTRACT)) {
+        return false;
+    }
+
+    rewrite(local, op == OP_ADD ? OP_ADD_LOCAL_CONST : OP_SUBTRACT_LOCAL_CONST);
+    local->operands[1] = constant->operands[0];
+
+    removeInstruction(optimizer, sequence[1]);
+    removeInstruction(optimizer, sequence[2]);
+
+    return true;
+}
+
+static bool fusePair(Optimizer* optimizer, int index) {
+    Instruction* instructions = optimizer->instructions;
+    int sequence[2];
+
+    if (!sequenceAt(optimizer, index, sequence, 2)) return false;
+
+    Instruction* a = &instructions[sequence[0]];
+    Instruction* b = &instructions[sequence[1]];
+
+    if (a->op == OP_GET_LOCAL && b->op == OP_RETURN) {
+        rewrite(a, OP_RETURN_LOCAL);
+    } else if (a->op == OP_SET_LOCAL && b->op == OP_POP) {
+        rewrite(a, OP_SET_LOCAL_POP);
+    } else if (a->op == OP_GET_LOCAL && b->op == OP_GET_LOCAL) {
+        rewrite(a, OP_GET_LOCAL_GET_LOCAL);
+        a->operands[1] = b->operands[0];
+    } else {
+        return false;
+    }
+
+    removeInstruction(optimizer, sequence[1]);
+
+    return true;
+}
+
+// The superinstructions were picked from a histogram of the instruction pairs
+// executed by the benchmarks. Longer sequences are replaced first, so that a
+// shorter one does not take instructions a longer one could have used.
+static bool (*fusions[])(Optimizer*, int) = { fuseCompareJump, fuseLocalConstant, fusePair };
+
+static void decode(Optimizer* optimizer, Chunk* chunk, int* indexAt) {
+    int count = 0;
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        Instruction* instruction = &optimizer->instructions[count];
+        instruction->offset = offset;
+        instruction->length = instructionLength(chunk, offset);
+        instruction->line = chunk->lines[offset];
+        instruction->op = chunk->code[offset];
+        instruction->operands[0] = instruction->length > 1 ? chunk->code[offset + 1] : 0;
+        instruction->operands[1] = instruction->length > 2 ? chunk->code[offset + 2] : 0;
+        instruction->rewritten = false;
+        instruction->removed = false;
+        instruction->target = -1;
+        instruction->jumpsIn = 0;
+
+        indexAt[offset] = count++;
+    }
+
+    optimizer->count = count;
+
+    for (int i = 0; i < count; i++) {
+        Instruction* instruction = &optimizer->instructions[i];
+        if (!isJump(instruction->op)) continue;
+
+        // The offset is always the last operand.
+        int end = instruction->offset + instruction->length;
+        int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+        instruction->target = indexAt[end + (instruction->op == OP_LOOP ? -jump : jump)];
+    }
+}
+
+static int encodedLength(Instruction* instruction) {
+    if (!instruction->rewritten) return instruction->length;
+
+    return 1 + operandCount(instruction->op) + (isJump(instruction->op) ? 2 : 0);
+}
+
+// Writes the instructions back into [chunk], reading the operands of those
+// left untouched from [original]. [newOffset] is scratch space with room for
+// an entry per instruction.
+static void encode(Optimizer* optimizer, Chunk* chunk, uint8_t* original, int* newOffset) {
+    int count = 0;
+
+    for (int i = 0; i < optimizer->count; i++) {
+        newOffset[i] = count;
+        if (!optimizer->instructions[i].removed) count += encodedLength(&optimizer->instructions[i]);
+    }
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction* instruction = &optimizer->instructions[i];
+        if (instruction->removed) continue;
+
+        uint8_t* code = chunk->code + newOffset[i];
+        int length = encodedLength(instruction);
+
+        if (isJump(instruction->op)) {
+            int from = newOffset[i] + length;
+            int to = newOffset[instruction->target];
+            uint8_t op = instruction->op;
+
+            // Threading can send an unconditional jump backwards, or a loop
+            // forwards.
+            if (op == OP_JUMP || op == OP_LOOP) op = to < from ? OP_LOOP : OP_JUMP;
+
+            int jump = op == OP_LOOP ? from - to : to - from;
+            code[0] = op;
+            for (int j = 1; j < length - 2; j++) code[j] = instruction->operands[j - 1];
+            code[length - 2] = (jump >> 8) & 0xff;
+            code[length - 1] = jump & 0xff;
+        } else if (instruction->rewritten) {
+            code[0] = instruction->op;
+            for (int j = 1; j < length; j++) code[j] = instruction->operands[j - 1];
+        } else {
+            memcpy(code, original + instruction->offset, length);
+        }
+
+        for (int j = 0; j < length; j++) {
+            chunk->lines[newOffset[i] + j] = instruction->line;
+        }
+    }
+
+    chunk->count = count;
+}
+
+void optimizeFunction(GhostVM *vm, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int size = chunk->count;
+
+    Optimizer optimizer;
+    optimizer.vm = vm;
+    optimizer.function = function;
+    optimizer.instructions = ALLOCATE(vm, Instruction, size);
+    optimizer.count = 0;
+
+    int* offsets = ALLOCATE(vm, int, size);
+    decode(&optimizer, chunk, offsets);
+    countJumps(&optimizer);
+
+    bool changed;
+    do {
+        changed = false;
+
+        for (int i = 0; i < optimizer.count; i++) {
+            if (optimizer.instructions[i].removed) continue;
+
+            if (simplifyAt(&optimizer, i)) changed = true;
+        }
+    } while (changed);
+
+    for (size_t fusion = 0; fusion < sizeof(fusions) / sizeof(fusions[0]); fusion++) {
+        for (int i = 0; i < optimizer.count; i++) {
+            if (optimizer.instructions[i].removed) continue;
+            fusions[fusion](&optimizer, i);
+        }
+    }
+
+    countJumps(&optimizer);
+
+    uint8_t* original = ALLOCATE(vm, uint8_t, size);
+    memcpy(original, chunk->code, size);
+    encode(&optimizer, chunk, original, offsets);
+
+    FREE_ARRAY(vm, uint8_t, original, size);
+    FREE_ARRAY(vm, int, offsets, size);
+    FREE_ARRAY(vm, Instruction, optimizer.instructions, size);
+}
\ No newline at end of file
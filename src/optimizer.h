@@ -0,0 +1,15 @@
+#ifndef ghost_optimizer_h
+#define ghost_optimizer_h
+
+#include "include/ghost.h"
+#include "object.h"
+
+// Rewrites the bytecode of [function] once the compiler has finished emitting
+// it: folds operations on constants, drops code that can never run, threads
+// jumps that land on other jumps and fuses common instruction pairs into
+// single instructions, including superinstructions for sequences that are
+// hot in typical loops and calls. Jump offsets and line information are kept
+// intact.
+void optimizeFunction(GhostVM *vm, ObjFunction* function);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "include/ghost.h"
+#include "memory.h"
+#include "pool.h"
+#include "vm.h"
+
+// Blocks start after the slab header, rounded up to keep them aligned.
+#define SLAB_HEADER_SIZE \
+    ((sizeof(PoolSlab) + POOL_GRANULARITY - 1) / POOL_GRANULARITY * POOL_GRANULARITY)
+
+void initPool(Pool* pool) {
+    pool->slabs = NULL;
+    pool->slabCount = 0;
+    pool->slabCapacity = 0;
+
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        pool->available[i] = NULL;
+    }
+}
+
+void freePool(GhostVM *vm, Pool* pool) {
+    for (int i = 0; i < pool->slabCount; i++) {
+        vm->reallocateFn(pool->slabs[i], POOL_SLAB_SIZE, 0);
+    }
+
+    vm->reallocateFn(pool->slabs, sizeof(PoolSlab*) * pool->slabCapacity, 0);
+    initPool(pool);
+}
+
+static void linkAvailable(Pool* pool, PoolSlab* slab) {
+    PoolSlab** head = &pool->available[slab->sizeClass];
+
+    slab->previous = NULL;
+    slab->next = *head;
+    if (*head != NULL) (*head)->previous = slab;
+    *head = slab;
+}
+
+static void unlinkAvailable(Pool* pool, PoolSlab* slab) {
+    if (slab->previous != NULL) {
+        slab->previous->next = slab->next;
+    } else {
+        pool->available[slab->sizeClass] = slab->next;
+    }
+
+    if (slab->next != NULL) slab->next->previous = slab->previous;
+}
+
+// Returns the index of the first slab at an address above [pointer].
+static int findSlabIndex(Pool* pool, void* pointer) {
+    int low = 0;
+    int high = pool->slabCount;
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+
+        if ((char*)pool->slabs[middle] <= (char*)pointer) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static PoolSlab* newSlab(GhostVM *vm, Pool* pool, int sizeClass) {
+    size_t blockSize = (size_t)(sizeClass + 1) * POOL_GRANULARITY;
+    PoolSlab* slab = vm->reallocateFn(NULL, 0, POOL_SLAB_SIZE);
+
+    slab->sizeClass = sizeClass;
+    slab->blockCount = (int)((POOL_SLAB_SIZE - SLAB_HEADER_SIZE) / blockSize);
+    slab->freeCount = slab->blockCount;
+    slab->freeList = NULL;
+
+    // Thread the blocks back to front so they are handed out in address
+    // order.
+    char* blocks = (char*)slab + SLAB_HEADER_SIZE;
+
+    for (int i = slab->blockCount - 1; i >= 0; i--) {
+        PoolBlock* block = (PoolBlock*)(blocks + i * blockSize);
+        block->next = slab->freeList;
+        slab->freeList = block;
+    }
+
+    if (pool->slabCapacity < pool->slabCount + 1) {
+        int oldCapacity = pool->slabCapacity;
+        pool->slabCapacity = GROW_CAPACITY(oldCapacity);
+        pool->slabs = vm->reallocateFn(pool->slabs, sizeof(PoolSlab*) * oldCapacity, sizeof(PoolSlab*) * pool->slabCapacity);
+    }
+
+    int index = findSlabIndex(pool, slab);
+    memmove(&pool->slabs[index + 1], &pool->slabs[index], sizeof(PoolSlab*) * (pool->slabCount - index));
+    pool->slabs[index] = slab;
+    pool->slabCount++;
+
+    linkAvailable(pool, slab);
+    return slab;
+}
+
+void* poolAllocate(GhostVM *vm, Pool* pool, size_t size) {
+    int sizeClass = (int)((size - 1) / POOL_GRANULARITY);
+    PoolSlab* slab = pool->available[sizeClass];
+
+    if (slab == NULL) slab = newSlab(vm, pool, sizeClass);
+
+    PoolBlock* block = slab->freeList;
+    slab->freeList = block->next;
+
+    if (--slab->freeCount == 0) unlinkAvailable(pool, slab);
+
+    return block;
+}
+
+void poolFree(Pool* pool, void* pointer) {
+    PoolSlab* slab = pool->slabs[findSlabIndex(pool, pointer) - 1];
+    PoolBlock* block = (PoolBlock*)pointer;
+
+    block->next = slab->freeList;
+    slab->freeList = block;
+
+    if (slab->freeCount++ == 0) linkAvailable(pool, slab);
+}
+
+void poolReleaseEmptySlabs(GhostVM *vm, Pool* pool) {
+    // Hold on to one empty slab per class, so a program that keeps
+    // allocating and dropping objects doesn't get a new slab every time.
+    bool spare[POOL_CLASS_COUNT] = { false };
+    int kept = 0;
+
+    for (int i = 0; i < pool->slabCount; i++) {
+        PoolSlab* slab = pool->slabs[i];
+
+        if (slab->freeCount == slab->blockCount && !spare[slab->sizeClass]) {
+            spare[slab->sizeClass] = true;
+            pool->slabs[kept++] = slab;
+        } else if (slab->freeCount == slab->blockCount) {
+            unlinkAvailable(pool, slab);
+            vm->reallocateFn(slab, POOL_SLAB_SIZE, 0);
+        } else {
+            pool->slabs[kept++] = slab;
+        }
+    }
+
+    pool->slabCount = kept;
+}
\ No newline at end of file
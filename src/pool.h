@@ -0,0 +1,66 @@
+#ifndef ghost_pool_h
+#define ghost_pool_h
+
+// Object structs come in a handful of small, fixed sizes, and scripts create
+// and drop huge numbers of them. Rather than going to the general purpose
+// allocator for each one, the VM keeps a pool for every size class: slabs
+// that are carved into equally sized blocks, with freed blocks threaded onto
+// the free list of the slab they came from.
+//
+// Keeping the free lists per slab means a slab knows when all of its blocks
+// are free again. After each sweep, such empty slabs are handed back to the
+// allocator so a heap that shrinks doesn't stay fragmented.
+
+#include "include/ghost.h"
+#include "common.h"
+
+// Block sizes are multiples of this, which also keeps every block aligned.
+#define POOL_GRANULARITY 16
+
+// The number of size classes. Larger allocations bypass the pool.
+#define POOL_CLASS_COUNT 16
+#define POOL_MAX_SIZE (POOL_GRANULARITY * POOL_CLASS_COUNT)
+
+// The number of bytes requested from the allocator for each slab.
+#define POOL_SLAB_SIZE (32 * 1024)
+
+typedef struct sPoolBlock {
+    struct sPoolBlock* next;
+} PoolBlock;
+
+typedef struct sPoolSlab {
+    // Links in the list of slabs of the same class with a free block.
+    struct sPoolSlab* previous;
+    struct sPoolSlab* next;
+
+    PoolBlock* freeList;
+    int sizeClass;
+    int freeCount;
+    int blockCount;
+} PoolSlab;
+
+typedef struct {
+    // Every slab, sorted by address so the one a block came from can be
+    // found with a binary search.
+    PoolSlab** slabs;
+    int slabCount;
+    int slabCapacity;
+
+    // For each size class, the slabs that still have a free block.
+    PoolSlab* available[POOL_CLASS_COUNT];
+} Pool;
+
+void initPool(Pool *pool);
+void freePool(GhostVM *vm, Pool *pool);
+
+// Returns a block of at least [size] bytes, which must not exceed
+// POOL_MAX_SIZE.
+void* poolAllocate(GhostVM *vm, Pool *pool, size_t size);
+
+// Returns [block], which came from poolAllocate(), to its slab.
+void poolFree(Pool *pool, void *block);
+
+// Gives the slabs that have no blocks in use back to the allocator.
+void poolReleaseEmptySlabs(GhostVM *vm, Pool *pool);
+
+#endif
\ No newline at end of file
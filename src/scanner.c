@@ -148,6 +148,7 @@ static TokenType identifierType() {
             if (scanner.current - scanner.start > 1) {
                 switch (scanner.start[1]) {
                     case 'f': return checkKeyword(2, 0, "", TOKEN_IF);
+                    case 'm': return checkKeyword(2, 4, "port", TOKEN_IMPORT);
                     case 'n': return checkKeyword(2, 5, "clude", TOKEN_INCLUDE);
                 }
             }
@@ -234,6 +235,7 @@ Token scanToken() {
         case '/': return makeToken(TOKEN_SLASH);
         case '*': return makeToken(TOKEN_STAR);
         case '%': return makeToken(TOKEN_PERCENT);
+        case ':': return makeToken(TOKEN_COLON);
 
         case '!':
             return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
@@ -17,6 +17,7 @@ typedef enum {
     TOKEN_SLASH,
     TOKEN_STAR,
     TOKEN_PERCENT,
+    TOKEN_COLON,
 
     // One or two character tokens
     TOKEN_BANG,
@@ -51,6 +52,7 @@ typedef enum {
     TOKEN_WHILE,
     TOKEN_EXTENDS,
     TOKEN_INCLUDE,
+    TOKEN_IMPORT,
 
     TOKEN_ERROR,
     TOKEN_EOF
@@ -0,0 +1,79 @@
+#include "include/ghost.h"
+#include "memory.h"
+#include "shape.h"
+#include "vm.h"
+
+static Shape* newShape(GhostVM *vm, int fieldCount) {
+    Shape* shape = ALLOCATE(vm, Shape, 1);
+    shape->id = vm->shapeCount;
+    shape->fieldCount = fieldCount;
+    initTable(&shape->slots);
+    initTable(&shape->transitions);
+
+    if (vm->shapeCapacity < vm->shapeCount + 1) {
+        int oldCapacity = vm->shapeCapacity;
+        vm->shapeCapacity = GROW_CAPACITY(oldCapacity);
+        vm->shapes = GROW_ARRAY(vm, vm->shapes, Shape*, oldCapacity, vm->shapeCapacity);
+    }
+
+    vm->shapes[vm->shapeCount++] = shape;
+    return shape;
+}
+
+void initShapes(GhostVM *vm) {
+    vm->shapes = NULL;
+    vm->shapeCount = 0;
+    vm->shapeCapacity = 0;
+
+    // The root shape, with no fields, that every instance starts out with.
+    newShape(vm, 0);
+}
+
+void freeShapes(GhostVM *vm) {
+    for (int i = 0; i < vm->shapeCount; i++) {
+        Shape* shape = vm->shapes[i];
+        freeTable(vm, &shape->slots);
+        freeTable(vm, &shape->transitions);
+        FREE(vm, Shape, shape);
+    }
+
+    FREE_ARRAY(vm, Shape*, vm->shapes, vm->shapeCapacity);
+    vm->shapes = NULL;
+    vm->shapeCount = 0;
+    vm->shapeCapacity = 0;
+}
+
+void markShapes(GhostVM *vm) {
+    for (int i = 0; i < vm->shapeCount; i++) {
+        markTable(vm, &vm->shapes[i]->slots);
+        markTable(vm, &vm->shapes[i]->transitions);
+    }
+}
+
+int shapeFindSlot(Shape *shape, ObjString *name) {
+    Value slot;
+
+    if (!tableGet(&shape->slots, name, &slot)) return -1;
+
+    return (int)AS_NUMBER(slot);
+}
+
+Shape* shapeTransition(GhostVM *vm, Shape *shape, ObjString *name) {
+    Value next;
+
+    if (tableGet(&shape->transitions, name, &next)) {
+        return vm->shapes[(int)AS_NUMBER(next)];
+    }
+
+    if (shape->fieldCount == SHAPE_MAX_FIELDS) return NULL;
+    if (shape->transitions.count == SHAPE_MAX_TRANSITIONS) return NULL;
+
+    Shape* child = newShape(vm, shape->fieldCount + 1);
+
+    tableAddAll(vm, &shape->slots, &child->slots);
+    tableSet(vm, &child->slots, name, NUMBER_VAL(shape->fieldCount));
+    tableSet(vm, &shape->transitions, name, NUMBER_VAL(child->id));
+    markNewRoot(vm, (Obj*)name);
+
+    return child;
+}
@@ -0,0 +1,54 @@
+#ifndef ghost_shape_h
+#define ghost_shape_h
+
+// Shapes, also known as hidden classes, describe the layout of an instance's
+// fields: which names it has and which slot of its flat value array holds
+// each one. Instances that gain the same fields in the same order share the
+// same shape, so a field access only has to consult one shared table (or an
+// inline cache) instead of a hash table owned by every single instance.
+//
+// Adding a field moves an instance from its shape to a child shape. These
+// transitions are remembered, so building many objects the same way walks the
+// same chain of shapes. Every chain starts at the VM's empty root shape.
+//
+// Shapes are owned by the VM and live until it is freed, which keeps pointers
+// to them stable for the inline caches. Instances that would make the tree
+// grow without bound give up on shapes and store their fields in a Table.
+
+#include "include/ghost.h"
+#include "common.h"
+#include "table.h"
+#include "value.h"
+
+// The most fields an instance can have before it falls back to a dictionary.
+#define SHAPE_MAX_FIELDS 64
+
+// The most distinct shapes that may be reached from a single shape.
+#define SHAPE_MAX_TRANSITIONS 32
+
+typedef struct sShape {
+    // Index of this shape in the VM's shape list.
+    int id;
+
+    // The number of fields an instance with this shape has.
+    int fieldCount;
+
+    // Maps each field name to the number of the slot that holds it.
+    Table slots;
+
+    // Maps a field name to the id of the shape reached by adding it.
+    Table transitions;
+} Shape;
+
+void initShapes(GhostVM *vm);
+void freeShapes(GhostVM *vm);
+void markShapes(GhostVM *vm);
+
+// Returns the slot holding [name] in instances of [shape], or -1.
+int shapeFindSlot(Shape *shape, ObjString *name);
+
+// Returns the shape reached from [shape] by adding the field [name], creating
+// it if needed. Returns NULL if instances should stop using shapes instead.
+Shape *shapeTransition(GhostVM *vm, Shape *shape, ObjString *name);
+
+#endif
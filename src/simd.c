@@ -0,0 +1,262 @@
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SIMD_X86 1
+    #include <immintrin.h>
+#else
+    #define SIMD_X86 0
+#endif
+
+#if SIMD_X86
+
+// Checked once; the answer cannot change while the process runs.
+static bool hasAVX2(void) {
+    static int supported = -1;
+
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    return supported == 1;
+}
+
+__attribute__((target("avx2")))
+static int addAVX2(double *a, const double *b, int count) {
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d sum = _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        _mm256_storeu_pd(a + i, sum);
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int addSSE2(double *a, const double *b, int count) {
+    int i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int multiplyAVX2(double *a, const double *b, int count) {
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d product = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        _mm256_storeu_pd(a + i, product);
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int multiplySSE2(double *a, const double *b, int count) {
+    int i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int scaleAVX2(double *a, double factor, int count) {
+    __m256d scale = _mm256_set1_pd(factor);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), scale));
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int scaleSSE2(double *a, double factor, int count) {
+    __m128d scale = _mm_set1_pd(factor);
+    int i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), scale));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int fillAVX2(double *a, double value, int count) {
+    __m256d fill = _mm256_set1_pd(value);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(a + i, fill);
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int fillSSE2(double *a, double value, int count) {
+    __m128d fill = _mm_set1_pd(value);
+    int i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i, fill);
+    }
+
+    return i;
+}
+
+// The reductions keep two vector accumulators so consecutive additions do not
+// wait on each other, and return how many elements they consumed.
+
+__attribute__((target("avx2")))
+static int dotAVX2(const double *a, const double *b, int count, double *result) {
+    __m256d first = _mm256_setzero_pd();
+    __m256d second = _mm256_setzero_pd();
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        first = _mm256_add_pd(first, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        second = _mm256_add_pd(second, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(first, second));
+    *result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int dotSSE2(const double *a, const double *b, int count, double *result) {
+    __m128d first = _mm_setzero_pd();
+    __m128d second = _mm_setzero_pd();
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        first = _mm_add_pd(first, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        second = _mm_add_pd(second, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(first, second));
+    *result = lanes[0] + lanes[1];
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int sumAVX2(const double *a, int count, double *result) {
+    __m256d first = _mm256_setzero_pd();
+    __m256d second = _mm256_setzero_pd();
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        first = _mm256_add_pd(first, _mm256_loadu_pd(a + i));
+        second = _mm256_add_pd(second, _mm256_loadu_pd(a + i + 4));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(first, second));
+    *result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int sumSSE2(const double *a, int count, double *result) {
+    __m128d first = _mm_setzero_pd();
+    __m128d second = _mm_setzero_pd();
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        first = _mm_add_pd(first, _mm_loadu_pd(a + i));
+        second = _mm_add_pd(second, _mm_loadu_pd(a + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(first, second));
+    *result = lanes[0] + lanes[1];
+
+    return i;
+}
+
+#endif
+
+// Each kernel lets the vector code handle as much of the array as it can and
+// finishes the remaining elements one at a time.
+
+void simdAdd(double *a, const double *b, int count) {
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? addAVX2(a, b, count) : addSSE2(a, b, count);
+    #endif
+
+    for (; i < count; i++) a[i] += b[i];
+}
+
+void simdMultiply(double *a, const double *b, int count) {
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? multiplyAVX2(a, b, count) : multiplySSE2(a, b, count);
+    #endif
+
+    for (; i < count; i++) a[i] *= b[i];
+}
+
+void simdScale(double *a, double factor, int count) {
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? scaleAVX2(a, factor, count) : scaleSSE2(a, factor, count);
+    #endif
+
+    for (; i < count; i++) a[i] *= factor;
+}
+
+void simdFill(double *a, double value, int count) {
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? fillAVX2(a, value, count) : fillSSE2(a, value, count);
+    #endif
+
+    for (; i < count; i++) a[i] = value;
+}
+
+double simdDot(const double *a, const double *b, int count) {
+    double result = 0;
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? dotAVX2(a, b, count, &result) : dotSSE2(a, b, count, &result);
+    #endif
+
+    for (; i < count; i++) result += a[i] * b[i];
+
+    return result;
+}
+
+double simdSum(const double *a, int count) {
+    double result = 0;
+    int i = 0;
+
+    #if SIMD_X86
+        i = hasAVX2() ? sumAVX2(a, count, &result) : sumSSE2(a, count, &result);
+    #endif
+
+    for (; i < count; i++) result += a[i];
+
+    return result;
+}
\ No newline at end of file
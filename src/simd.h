@@ -0,0 +1,17 @@
+#ifndef ghost_simd_h
+#define ghost_simd_h
+
+#include "common.h"
+
+// Bulk kernels over packed doubles. On x86 they use AVX2 when the CPU has it
+// and SSE2 otherwise, and plain loops elsewhere. Sums are accumulated in
+// several lanes, so their rounding can differ from a left to right loop.
+
+void simdAdd(double *a, const double *b, int count);
+void simdMultiply(double *a, const double *b, int count);
+void simdScale(double *a, double factor, int count);
+void simdFill(double *a, double value, int count);
+double simdDot(const double *a, const double *b, int count);
+double simdSum(const double *a, int count);
+
+#endif
\ No newline at end of file
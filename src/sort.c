@@ -0,0 +1,230 @@
+#include "sort.h"
+
+// Pattern-defeating quicksort (Orson Peters, 2016): introsort with a few
+// additions that make already sorted, reversed and duplicate-heavy input run
+// in linear time. Unlike the reference implementation, every scan is bounds
+// checked, since a script comparator is free to be inconsistent.
+
+// Ranges shorter than this are insertion sorted.
+#define INSERTION_SORT_THRESHOLD 24
+
+// Ranges longer than this pick their pivot as a median of three medians.
+#define NINTHER_THRESHOLD 128
+
+// How many elements partialInsertionSort() may move before giving up.
+#define PARTIAL_INSERTION_SORT_LIMIT 8
+
+static inline bool less(SortContext *context, SortEntry *a, SortEntry *b) {
+    if (context->failed) return false;
+    return context->less(context, a->key, b->key);
+}
+
+static inline void swap(SortEntry *a, SortEntry *b) {
+    SortEntry entry = *a;
+    *a = *b;
+    *b = entry;
+}
+
+static void sort2(SortContext *context, SortEntry *a, SortEntry *b) {
+    if (less(context, b, a)) swap(a, b);
+}
+
+// Puts the median of the three entries in [b].
+static void sort3(SortContext *context, SortEntry *a, SortEntry *b, SortEntry *c) {
+    sort2(context, a, b);
+    sort2(context, b, c);
+    sort2(context, a, b);
+}
+
+static void insertionSort(SortContext *context, SortEntry *begin, SortEntry *end) {
+    for (SortEntry *current = begin + 1; current < end; current++) {
+        SortEntry entry = *current;
+        SortEntry *hole = current;
+
+        while (hole > begin && less(context, &entry, hole - 1)) {
+            *hole = *(hole - 1);
+            hole--;
+        }
+
+        *hole = entry;
+    }
+}
+
+// Insertion sorts the range, unless that would take more than a few moves.
+// Returns whether the range ended up sorted.
+static bool partialInsertionSort(SortContext *context, SortEntry *begin, SortEntry *end) {
+    int moves = 0;
+
+    for (SortEntry *current = begin + 1; current < end; current++) {
+        if (moves > PARTIAL_INSERTION_SORT_LIMIT) return false;
+
+        SortEntry entry = *current;
+        SortEntry *hole = current;
+
+        while (hole > begin && less(context, &entry, hole - 1)) {
+            *hole = *(hole - 1);
+            hole--;
+        }
+
+        *hole = entry;
+        moves += (int)(current - hole);
+    }
+
+    return true;
+}
+
+static void siftDown(SortContext *context, SortEntry *heap, int count, int root) {
+    for (;;) {
+        int child = root * 2 + 1;
+        if (child >= count) return;
+
+        if (child + 1 < count && less(context, &heap[child], &heap[child + 1])) child++;
+        if (!less(context, &heap[root], &heap[child])) return;
+
+        swap(&heap[root], &heap[child]);
+        root = child;
+    }
+}
+
+static void heapSort(SortContext *context, SortEntry *begin, SortEntry *end) {
+    int count = (int)(end - begin);
+
+    for (int i = count / 2 - 1; i >= 0; i--) {
+        siftDown(context, begin, count, i);
+    }
+
+    for (int i = count - 1; i > 0; i--) {
+        swap(&begin[0], &begin[i]);
+        siftDown(context, begin, i, 0);
+    }
+}
+
+// Partitions the range around the pivot in [begin] into the entries that sort
+// before it and the rest, and returns where the pivot ends up.
+// [alreadyPartitioned] tells whether that took no swaps.
+static SortEntry *partitionRight(SortContext *context, SortEntry *begin, SortEntry *end,
+                                 bool *alreadyPartitioned) {
+    SortEntry *left = begin + 1;
+    SortEntry *right = end - 1;
+    bool swapped = false;
+
+    for (;;) {
+        while (left <= right && less(context, left, begin)) left++;
+        while (left <= right && !less(context, right, begin)) right--;
+        if (left >= right) break;
+
+        swap(left++, right--);
+        swapped = true;
+    }
+
+    SortEntry *pivot = left - 1;
+    swap(begin, pivot);
+
+    *alreadyPartitioned = !swapped;
+    return pivot;
+}
+
+// Like partitionRight(), but entries equal to the pivot go to its left.
+static SortEntry *partitionLeft(SortContext *context, SortEntry *begin, SortEntry *end) {
+    SortEntry *left = begin + 1;
+    SortEntry *right = end - 1;
+
+    for (;;) {
+        while (left <= right && !less(context, begin, left)) left++;
+        while (left <= right && less(context, begin, right)) right--;
+        if (left >= right) break;
+
+        swap(left++, right--);
+    }
+
+    SortEntry *pivot = left - 1;
+    swap(begin, pivot);
+    return pivot;
+}
+
+// Moves a few entries of a range that partitioned badly, to break up
+// whatever pattern caused it.
+static void shuffle(SortEntry *begin, SortEntry *end) {
+    int count = (int)(end - begin);
+    int quarter = count / 4;
+
+    swap(begin, begin + quarter);
+    swap(end - 1, end - quarter);
+
+    if (count > NINTHER_THRESHOLD) {
+        swap(begin + 1, begin + quarter + 1);
+        swap(begin + 2, begin + quarter + 2);
+        swap(end - 2, end - quarter - 1);
+        swap(end - 3, end - quarter - 2);
+    }
+}
+
+// [leftmost] is false when the entry just before [begin] is a pivot that
+// nothing in the range sorts before.
+static void pdqsort(SortContext *context, SortEntry *begin, SortEntry *end,
+                    int badAllowed, bool leftmost) {
+    for (;;) {
+        if (context->failed) return;
+
+        int count = (int)(end - begin);
+
+        if (count < INSERTION_SORT_THRESHOLD) {
+            insertionSort(context, begin, end);
+            return;
+        }
+
+        int half = count / 2;
+
+        if (count > NINTHER_THRESHOLD) {
+            sort3(context, begin, begin + half, end - 1);
+            sort3(context, begin + 1, begin + half - 1, end - 2);
+            sort3(context, begin + 2, begin + half + 1, end - 3);
+            sort3(context, begin + half - 1, begin + half, begin + half + 1);
+            swap(begin, begin + half);
+        } else {
+            sort3(context, begin + half, begin, end - 1);
+        }
+
+        // If the pivot equals the preceding pivot, every entry equal to it
+        // can be set aside at once, which makes runs of duplicates linear.
+        if (!leftmost && !less(context, begin - 1, begin)) {
+            begin = partitionLeft(context, begin, end) + 1;
+            continue;
+        }
+
+        bool alreadyPartitioned;
+        SortEntry *pivot = partitionRight(context, begin, end, &alreadyPartitioned);
+
+        int leftCount = (int)(pivot - begin);
+        int rightCount = (int)(end - (pivot + 1));
+
+        if (leftCount < count / 8 || rightCount < count / 8) {
+            // Too many bad pivots means the input is adversarial, so fall back
+            // to heapsort to stay O(n log n).
+            if (--badAllowed == 0) {
+                heapSort(context, begin, end);
+                return;
+            }
+
+            if (leftCount >= INSERTION_SORT_THRESHOLD) shuffle(begin, pivot);
+            if (rightCount >= INSERTION_SORT_THRESHOLD) shuffle(pivot + 1, end);
+        } else if (alreadyPartitioned &&
+                   partialInsertionSort(context, begin, pivot) &&
+                   partialInsertionSort(context, pivot + 1, end)) {
+            // The range was probably sorted already, and now certainly is.
+            return;
+        }
+
+        pdqsort(context, begin, pivot, badAllowed, leftmost);
+        begin = pivot + 1;
+        leftmost = false;
+    }
+}
+
+void sortEntries(SortContext *context, SortEntry *entries, int count) {
+    int badAllowed = 1;
+
+    while (count >> badAllowed) badAllowed++;
+
+    pdqsort(context, entries, entries + count, badAllowed, true);
+}
\ No newline at end of file
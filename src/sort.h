@@ -0,0 +1,30 @@
+#ifndef ghost_sort_h
+#define ghost_sort_h
+
+#include "common.h"
+#include "value.h"
+
+// Entries are ordered by [key]; [value] just travels along with it.
+typedef struct {
+    Value key;
+    Value value;
+} SortEntry;
+
+typedef struct sSortContext SortContext;
+
+// Returns whether key [a] sorts before key [b]. A comparison that fails sets
+// [context]->failed, after which the sort gives up as soon as it can.
+typedef bool (*SortLessFn)(SortContext *context, Value a, Value b);
+
+struct sSortContext {
+    GhostVM *vm;
+    SortLessFn less;
+
+    // The script comparator, for less functions that call one.
+    Value comparator;
+    bool failed;
+};
+
+void sortEntries(SortContext *context, SortEntry *entries, int count);
+
+#endif
\ No newline at end of file
@@ -9,6 +9,12 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+// Tables use Robin Hood probing: an insertion takes the slot of any entry
+// sitting closer to its home slot than the new key would, and carries on with
+// the entry it displaced. Runs of keys therefore stay ordered by how far they
+// are from home, which lets a probe stop early and lets tableDelete() shift
+// the rest of a run back instead of leaving a tombstone behind.
+
 void initTable(Table* table) {
     table->count = 0;
     table->capacity = -1;
@@ -20,36 +26,55 @@ void freeTable(GhostVM *vm, Table* table) {
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash & capacity;
-    Entry* tombstone = NULL;
+// Returns the entry for [key], or NULL if it is not in the table.
+static Entry* findEntry(Table* table, ObjString* key) {
+    if (table->count == 0) return NULL;
+
+    uint32_t index = key->hash & table->capacity;
+
+    for (uint32_t distance = 1;; distance++) {
+        Entry* entry = &table->entries[index];
+
+        // An entry closer to home than [key] would be, or an empty slot,
+        // means [key] is not further along.
+        if (entry->distance < distance) return NULL;
+        if (entry->key == key) return entry;
+
+        index = (index + 1) & table->capacity;
+    }
+}
+
+// Places a key that is not in [entries] yet.
+static void insertEntry(Entry* entries, int capacity, ObjString* key, Value value, uint32_t hash) {
+    Entry entry = {key, value, hash, 1};
+    uint32_t index = hash & capacity;
 
     for (;;) {
-        Entry* entry = &entries[index];
-
-        if (entry->key == NULL) {
-            if (IS_NULL(entry->value)) {
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            return entry;
+        Entry* slot = &entries[index];
+
+        if (slot->distance == 0) {
+            *slot = entry;
+            return;
         }
 
+        if (slot->distance < entry.distance) {
+            Entry displaced = *slot;
+            *slot = entry;
+            entry = displaced;
+        }
+
+        entry.distance++;
         index = (index + 1) & capacity;
     }
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
-
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    Entry* entry = findEntry(table, key);
+    if (entry == NULL) return false;
 
     *value = entry->value;
 
-    return value;
+    return true;
 }
 
 static void adjustCapacity(GhostVM *vm, Table* table, int capacity) {
@@ -58,18 +83,14 @@ static void adjustCapacity(GhostVM *vm, Table* table, int capacity) {
     for (int i = 0; i <= capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NULL_VAL;
+        entries[i].distance = 0;
     }
 
-    table->count = 0;
-
     for (int i = 0; i <= table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key == NULL) continue;
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        insertEntry(entries, capacity, entry->key, entry->value, entry->hash);
     }
 
     FREE_ARRAY(vm, Entry, table->entries, table->capacity + 1);
@@ -79,32 +100,47 @@ static void adjustCapacity(GhostVM *vm, Table* table, int capacity) {
 }
 
 bool tableSet(GhostVM *vm, Table* table, ObjString* key, Value value) {
+    Entry* entry = findEntry(table, key);
+
+    if (entry != NULL) {
+        entry->value = value;
+        return false;
+    }
+
     if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
         int capacity = GROW_CAPACITY(table->capacity + 1) - 1;
         adjustCapacity(vm, table, capacity);
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NULL(entry->value)) table->count++;
+    insertEntry(table->entries, table->capacity, key, value, key->hash);
+    table->count++;
 
-    entry->key = key;
-    entry->value = value;
-
-    return isNewKey;
+    return true;
 }
 
 bool tableDelete(Table* table, ObjString* key) {
-    if (table->count == 0) return false;
+    Entry* entry = findEntry(table, key);
+    if (entry == NULL) return false;
 
-    // Find the entry
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    // Shift the rest of the run back one slot, up to an empty slot or an
+    // entry that is already at home.
+    uint32_t index = (uint32_t)(entry - table->entries);
+
+    for (;;) {
+        uint32_t next = (index + 1) & table->capacity;
+        Entry* following = &table->entries[next];
+
+        if (following->distance <= 1) break;
+
+        table->entries[index] = *following;
+        table->entries[index].distance--;
+        index = next;
+    }
 
-    // Place a tombstone in the entry
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    table->entries[index].key = NULL;
+    table->entries[index].value = NULL_VAL;
+    table->entries[index].distance = 0;
+    table->count--;
 
     return true;
 }
@@ -124,14 +160,12 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
 
     uint32_t index = hash & table->capacity;
 
-    for (;;) {
+    for (uint32_t distance = 1;; distance++) {
         Entry* entry = &table->entries[index];
 
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tombstone entry
-            if (IS_NULL(entry->value)) return NULL;
-        } else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
-            // We found it
+        if (entry->distance < distance) return NULL;
+
+        if (entry->hash == hash && entry->key->length == length && memcmp(entry->key->chars, chars, length) == 0) {
             return entry->key;
         }
 
@@ -139,16 +173,6 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
     }
 }
 
-void tableRemoveWhite(Table* table) {
-    for (int i = 0; i <= table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
-        }
-    }
-}
-
 void markTable(GhostVM *vm, Table* table) {
     for (int i = 0; i <= table->capacity; i++) {
         Entry* entry = &table->entries[i];
@@ -7,6 +7,13 @@
 typedef struct {
     ObjString* key;
     Value value;
+    // A copy of the key's hash, so probing can skip most mismatched keys
+    // without loading the string they point to.
+    uint32_t hash;
+
+    // One more than how far the entry sits from the slot its hash selects,
+    // or zero if the slot is empty.
+    uint32_t distance;
 } Entry;
 
 typedef struct {
@@ -23,6 +30,5 @@ bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(GhostVM *vm, Table *from, Table *to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 
-void tableRemoveWhite(Table* table);
 void markTable(GhostVM *vm, Table *table);
 #endif
\ No newline at end of file
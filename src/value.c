@@ -49,6 +49,7 @@ void printValue(Value value) {
             case VAL_NULL:   printf("null"); break;
             case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
             case VAL_OBJ:    printObject(value); break;
+            case VAL_UNDEFINED: printf("undefined"); break;
         }
     #endif
 }
@@ -68,6 +69,7 @@ bool valuesEqual(Value a, Value b) {
             case VAL_NULL:    return true;
             case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
             case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+            case VAL_UNDEFINED: return true;
         }
     #endif
 }
\ No newline at end of file
@@ -18,6 +18,8 @@
 // Ghost implementation calls these "Obj", or objects, though to a user, all
 // values are objects.
 
+#include <limits.h>
+
 #include "include/ghost.h"
 #include "common.h"
 
@@ -32,10 +34,15 @@ typedef struct sObjString ObjString;
 #define TAG_FALSE   2 // 10.
 #define TAG_TRUE    3 // 11.
 
+// Marks a global variable slot that has been declared but not yet assigned.
+// It never appears as a value a Ghost program can see.
+#define TAG_UNDEFINED 4 // 100.
+
 typedef uint64_t Value;
 
 #define IS_BOOL(v)      (((v) & FALSE_VAL) == FALSE_VAL)
 #define IS_NULL(v)      ((v) == NULL_VAL)
+#define IS_UNDEFINED(v) ((v) == UNDEFINED_VAL)
 #define IS_NUMBER(v)    (((v) & QNAN) != QNAN)
 #define IS_OBJ(v)       (((v) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
@@ -47,6 +54,7 @@ typedef uint64_t Value;
 #define FALSE_VAL       ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL        ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NULL_VAL        ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define UNDEFINED_VAL   ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
 #define NUMBER_VAL(num) numToValue(num)
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
@@ -73,7 +81,8 @@ typedef enum {
     VAL_BOOL,
     VAL_NULL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_UNDEFINED
 } ValueType;
 
 typedef struct {
@@ -89,6 +98,7 @@ typedef struct {
 #define IS_NULL(value)    ((value).type == VAL_NULL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)    ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_OBJ(value)    ((value).as.obj)
 #define AS_BOOL(value)   ((value).as.boolean)
@@ -98,6 +108,7 @@ typedef struct {
 #define NULL_VAL           ((Value) { VAL_NULL, { .number = 0 }})
 #define NUMBER_VAL(value) ((Value) { VAL_NUMBER, { .number = value }})
 #define OBJ_VAL(object)   ((Value) { VAL_OBJ, { .obj = (Obj*)object }})
+#define UNDEFINED_VAL     ((Value) { VAL_UNDEFINED, { .number = 0 }})
 
 #endif
 
@@ -107,6 +118,18 @@ typedef struct {
     Value* values;
 } ValueArray;
 
+// Stores [number] in [index] if it is an integer within the range of int.
+// Casting any other double to int is undefined, so callers that index with a
+// Ghost number check it here first. NaN fails both comparisons.
+static inline bool numberToIndex(double number, int *index) {
+    if (!(number >= INT_MIN && number <= INT_MAX) || (double)(int)number != number) {
+        return false;
+    }
+
+    *index = (int)number;
+    return true;
+}
+
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(GhostVM *vm, ValueArray *array, Value value);
@@ -5,20 +5,28 @@
 #include <string.h>
 #include <time.h>
 
+#include "bytecode.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
 #include "include/ghost.h"
+#include "jit.h"
 #include "object.h"
 #include "memory.h"
+#include "module.h"
 #include "modules/modules.h"
 #include "native.h"
 #include "datatypes/string.h"
 #include "datatypes/list.h"
+#include "datatypes/map.h"
+#include "datatypes/floatarray.h"
 #include "utilities.h"
 #include "vm.h"
 #include "modules/math.h"
 
+// The most calls a runtime error's stack trace lists.
+#define STACK_TRACE_MAX 64
+
 static void resetStack(GhostVM *vm) {
     vm->stackTop = vm->stack;
     vm->frameCount = 0;
@@ -35,8 +43,16 @@ void runtimeError(GhostVM *vm, const char* format, ...) {
 
     fputs("\n", stderr);
 
-    // Print stack trace
+    // Print stack trace. A deep one is most likely a runaway recursion, so
+    // only its innermost calls are shown.
+    int shown = 0;
+
     for (int i = vm->frameCount - 1; i >= 0; i--) {
+        if (shown++ == STACK_TRACE_MAX) {
+            fprintf(stderr, "[... %d more calls]\n", i + 1);
+            break;
+        }
+
         CallFrame* frame = &vm->frames[i];
         ObjFunction* function = frame->closure->function;
 
@@ -57,34 +73,134 @@ void runtimeError(GhostVM *vm, const char* format, ...) {
     resetStack(vm);
 }
 
+// Returns the slot of the global variable [name], reserving a new, undefined
+// one if this is the first time the name has been seen.
+int declareGlobal(GhostVM *vm, ObjString *name) {
+    Value slot;
+
+    if (tableGet(&vm->globalSlots, name, &slot)) {
+        return (int)AS_NUMBER(slot);
+    }
+
+    push(vm, OBJ_VAL(name));
+    writeValueArray(vm, &vm->globalValues, UNDEFINED_VAL);
+    tableSet(vm, &vm->globalSlots, name, NUMBER_VAL(vm->globalValues.count - 1));
+    markNewRoot(vm, (Obj*)name);
+    pop(vm);
+
+    return vm->globalValues.count - 1;
+}
+
+void defineGlobal(GhostVM *vm, ObjString *name, Value value) {
+    int slot = declareGlobal(vm, name);
+    vm->globalValues.values[slot] = value;
+}
+
+// Finds the name of the global variable in [slot], for error messages.
+static ObjString* globalName(GhostVM *vm, int slot) {
+    for (int i = 0; i <= vm->globalSlots.capacity; i++) {
+        Entry* entry = &vm->globalSlots.entries[i];
+
+        if (entry->key != NULL && (int)AS_NUMBER(entry->value) == slot) {
+            return entry->key;
+        }
+    }
+
+    return NULL;
+}
+
 void defineNative(GhostVM *vm, const char* name, NativeFn function) {
-    push(vm, OBJ_VAL(copyString(vm, name, (int)strlen(name))));
+    push(vm, OBJ_VAL(externalString(vm, name, (int)strlen(name))));
     push(vm, OBJ_VAL(newNative(vm, function)));
-    tableSet(vm, &vm->globals, AS_STRING(vm->stack[0]), vm->stack[1]);
+    defineGlobal(vm, AS_STRING(vm->stack[0]), vm->stack[1]);
     pop(vm);
     pop(vm);
 }
 
-GhostVM *ghostNewVM(GhostReallocateFn reallocateFn) {
-    GhostVM* vm = reallocateFn(NULL, 0, sizeof(GhostVM));
+static void *defaultReallocate(void *memory, size_t oldSize, size_t newSize) {
+    if (newSize == 0) {
+        free(memory);
+        return NULL;
+    }
+
+    return realloc(memory, newSize);
+}
+
+void ghostInitConfiguration(GhostConfiguration* configuration) {
+    configuration->reallocateFn = defaultReallocate;
+    configuration->collector = GHOST_GC_GENERATIONAL;
+    configuration->nurserySize = 256 * 1024;
+    configuration->gcStepSize = 1024;
+    configuration->cacheBytecode = true;
+    configuration->maxCallDepth = 100000;
+    configuration->jitThreshold = 1000;
+}
+
+GhostVM *ghostNewVM(GhostConfiguration* configuration) {
+    GhostVM* vm = configuration->reallocateFn(NULL, 0, sizeof(GhostVM));
+    vm->reallocateFn = configuration->reallocateFn;
 
+    vm->frames = NULL;
+    vm->frameCapacity = 0;
+    vm->maxCallDepth = configuration->maxCallDepth;
+    vm->stack = NULL;
+    vm->stackCapacity = 0;
     resetStack(vm);
+
     vm->objects = NULL;
+    vm->youngObjects = NULL;
+
+    initPool(&vm->pool);
 
     vm->bytesAllocated = 0;
     vm->nextGC = 1024 * 1024;
 
+    vm->generational = configuration->collector == GHOST_GC_GENERATIONAL;
+    vm->nurserySize = configuration->nurserySize;
+    vm->nurseryLimit = vm->nurserySize;
+
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->remembered = NULL;
+
+    vm->gcPhase = GC_PHASE_IDLE;
+    vm->gcStepSize = configuration->gcStepSize;
+    vm->cacheBytecode = configuration->cacheBytecode;
+    vm->jitThreshold = configuration->jitThreshold;
+    vm->clearCursor = NULL;
+    vm->sweepOld = NULL;
+    vm->sweepYoung = NULL;
+
     vm->grayCount = 0;
     vm->grayCapacity = 0;
     vm->grayStack = NULL;
 
-    initTable(&vm->globals);
+    vm->classVersion = 0;
+
+    initTable(&vm->globalSlots);
+    initValueArray(&vm->globalValues);
     initTable(&vm->strings);
+    initTable(&vm->modules);
 
+    // Cleared before anything is allocated, since the collector marks them.
     vm->constructorString = NULL;
-    vm->constructorString = copyString(vm, "constructor", 11);
+    vm->listClass = NULL;
+    vm->mapClass = NULL;
+    vm->floatArrayClass = NULL;
+
+    initShapes(vm);
+
+    // Room for the values pushed before the first call.
+    vm->stack = ALLOCATE(vm, Value, FRAME_STACK_SLOTS);
+    vm->stackCapacity = FRAME_STACK_SLOTS;
+    vm->stackTop = vm->stack;
+
+    vm->constructorString = externalString(vm, "constructor", 11);
 
     defineAllNatives(vm);
+    registerListMethods(vm);
+    registerMapMethods(vm);
+    registerFloatArrayMethods(vm);
     registerAssertModule(vm);
     registerMathModule(vm);
 
@@ -92,14 +208,23 @@ GhostVM *ghostNewVM(GhostReallocateFn reallocateFn) {
 }
 
 void ghostFreeVM(GhostVM *vm) {
-    freeTable(vm, &vm->globals);
+    freeTable(vm, &vm->globalSlots);
+    freeValueArray(vm, &vm->globalValues);
     freeTable(vm, &vm->strings);
+    freeTable(vm, &vm->modules);
+    freeShapes(vm);
 
     vm->constructorString = NULL;
+    vm->listClass = NULL;
+    vm->mapClass = NULL;
+    vm->floatArrayClass = NULL;
 
     freeObjects(vm);
 
-    free(vm);
+    FREE_ARRAY(vm, CallFrame, vm->frames, vm->frameCapacity);
+    FREE_ARRAY(vm, Value, vm->stack, vm->stackCapacity);
+
+    vm->reallocateFn(vm, sizeof(GhostVM), 0);
 }
 
 void push(GhostVM *vm, Value value) {
@@ -117,17 +242,52 @@ static Value peek(GhostVM *vm, int distance) {
     return vm->stackTop[-1 - distance];
 }
 
+// Makes sure room for [slots] values and [FRAME_STACK_SLOTS] more is free
+// above the top of the value stack, moving the stack if it has to grow.
+static void ensureStack(GhostVM *vm, int slots) {
+    int used = (int)(vm->stackTop - vm->stack);
+    int needed = used + slots + FRAME_STACK_SLOTS;
+    if (needed <= vm->stackCapacity) return;
+
+    int capacity = vm->stackCapacity;
+    while (capacity < needed) capacity = GROW_CAPACITY(capacity);
+
+    Value* oldStack = vm->stack;
+    vm->stack = GROW_ARRAY(vm, vm->stack, Value, vm->stackCapacity, capacity);
+    vm->stackCapacity = capacity;
+
+    if (vm->stack == oldStack) return;
+
+    vm->stackTop = vm->stack + used;
+
+    for (int i = 0; i < vm->frameCount; i++) {
+        vm->frames[i].slots = vm->stack + (vm->frames[i].slots - oldStack);
+    }
+
+    for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = vm->stack + (upvalue->location - oldStack);
+    }
+}
+
 static bool call(GhostVM *vm, ObjClosure* closure, int argCount) {
     if (argCount != closure->function->arity) {
         runtimeError(vm, "Expected %d arguments but got %d.", closure->function->arity, argCount);
         return false;
     }
 
-    if (vm->frameCount == FRAMES_MAX) {
+    if (vm->frameCount == vm->maxCallDepth) {
         runtimeError(vm, "Stack overflow.");
         return false;
     }
 
+    if (vm->frameCount == vm->frameCapacity) {
+        int oldCapacity = vm->frameCapacity;
+        vm->frameCapacity = GROW_CAPACITY(oldCapacity);
+        vm->frames = GROW_ARRAY(vm, vm->frames, CallFrame, oldCapacity, vm->frameCapacity);
+    }
+
+    ensureStack(vm, closure->function->slotCount);
+
     CallFrame* frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
@@ -136,6 +296,27 @@ static bool call(GhostVM *vm, ObjClosure* closure, int argCount) {
     return true;
 }
 
+// Calls the body of [module] in place of the path on top of the stack. Like
+// any other call, it leaves its return value there once it finishes.
+static bool runModule(GhostVM *vm, ObjModule* module) {
+    module->executed = true;
+
+    ObjClosure* closure = newClosure(vm, module->function);
+    vm->stackTop[-1] = OBJ_VAL(closure);
+
+    return call(vm, closure, 0);
+}
+
+// Replaces any lazy strings among [count] stack [slots] with their flattened
+// strings, for code that only understands ObjString.
+static void flattenStrings(GhostVM *vm, Value* slots, int count) {
+    for (int i = 0; i < count; i++) {
+        if (IS_LAZY_STRING(slots[i])) {
+            slots[i] = OBJ_VAL(flattenString(vm, AS_LAZY_STRING(slots[i])));
+        }
+    }
+}
+
 static bool callValue(GhostVM *vm, Value callee, int argCount) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
@@ -166,7 +347,13 @@ static bool callValue(GhostVM *vm, Value callee, int argCount) {
 
             case OBJ_NATIVE: {
                 NativeFn native = AS_NATIVE(callee);
+                flattenStrings(vm, vm->stackTop - argCount, argCount);
                 Value result = native(vm, argCount, vm->stackTop - argCount);
+
+                // A native that fails reports it with runtimeError(), which
+                // has already unwound the stack.
+                if (vm->frameCount == 0) return false;
+
                 vm->stackTop -= argCount + 1;
                 push(vm, result);
                 return true;
@@ -193,7 +380,95 @@ static bool invokeFromClass(GhostVM *vm, ObjClass* klass, ObjString* name, int a
     return call(vm, AS_CLOSURE(method), argCount);
 }
 
-static bool invoke(GhostVM *vm, ObjString* name, int argCount) {
+// Finds the entry in [cache] filled for the class and shape of [instance], or
+// NULL on a miss. Instances without a shape are never cached.
+static inline InlineCacheEntry* findCacheEntry(InlineCache* cache, ObjInstance* instance) {
+    if (cache->count == INLINE_CACHE_MEGAMORPHIC) return NULL;
+
+    for (int i = 0; i < cache->count; i++) {
+        InlineCacheEntry* entry = &cache->entries[i];
+
+        if (entry->shape == instance->shape && entry->classVersion == instance->klass->version) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Records that, for instances of [klass] with [shape], the site owning [cache]
+// resolved to [fieldSlot] (or to [method], when [fieldSlot] is -1). For stores
+// that add a field, [transition] is the shape the instance moves to.
+static void updateCache(InlineCache* cache, ObjClass* klass, Shape* shape, int fieldSlot, Value method, Shape* transition) {
+    if (shape == NULL || cache->count == INLINE_CACHE_MEGAMORPHIC) return;
+
+    InlineCacheEntry* entry = NULL;
+
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == shape && cache->entries[i].classVersion == klass->version) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        if (cache->count == INLINE_CACHE_WAYS) {
+            // Too many kinds of objects flow through this site to be worth
+            // caching.
+            cache->count = INLINE_CACHE_MEGAMORPHIC;
+            return;
+        }
+
+        entry = &cache->entries[cache->count++];
+        entry->classVersion = klass->version;
+        entry->shape = shape;
+    }
+
+    entry->fieldSlot = fieldSlot;
+    entry->method = method;
+    entry->transition = transition;
+}
+
+// Looks [name] up on [instance] the slow way, filling in [cache] for the next
+// time. Returns true with the field in [value], or false with the method in
+// [method]. Returns false and leaves [method] NULL if neither exists.
+static bool lookupProperty(ObjInstance* instance, ObjString* name, InlineCache* cache, Value* value, Value* method) {
+    *method = NULL_VAL;
+
+    if (instance->shape != NULL) {
+        int slot = shapeFindSlot(instance->shape, name);
+
+        if (slot != -1) {
+            updateCache(cache, instance->klass, instance->shape, slot, NULL_VAL, NULL);
+            *value = *instanceField(instance, slot);
+            return true;
+        }
+    } else if (tableGet(instance->dictionary, name, value)) {
+        return true;
+    }
+
+    if (tableGet(&instance->klass->methods, name, method)) {
+        updateCache(cache, instance->klass, instance->shape, -1, *method, NULL);
+    }
+
+    return false;
+}
+
+// Calls the native [method] of a built-in type, which also gets the
+// receiver, as args[0].
+static bool callMethod(GhostVM *vm, Value method, int argCount) {
+    NativeFn native = AS_NATIVE(method);
+    Value result = native(vm, argCount, vm->stackTop - argCount - 1);
+
+    // As in callValue(), a failed native has already unwound the stack.
+    if (vm->frameCount == 0) return false;
+
+    vm->stackTop -= argCount + 1;
+    push(vm, result);
+    return true;
+}
+
+static bool invoke(GhostVM *vm, ObjString* name, int argCount, InlineCache* cache) {
     Value receiver = peek(vm, argCount);
 
     if (!IS_OBJ(receiver)) {
@@ -217,24 +492,71 @@ static bool invoke(GhostVM *vm, ObjString* name, int argCount) {
 
         case OBJ_INSTANCE: {
             ObjInstance* instance = AS_INSTANCE(receiver);
+            InlineCacheEntry* entry = findCacheEntry(cache, instance);
+
+            // The shape says which fields the instance has, so a cached
+            // method is known not to be shadowed by one.
+            if (entry != NULL && entry->fieldSlot < 0) {
+                return call(vm, AS_CLOSURE(entry->method), argCount);
+            }
 
             Value value;
+            Value method;
 
-            if (tableGet(&instance->fields, name, &value)) {
-                vm->stackTop[-argCount - 1] = value;
+            if (entry != NULL) {
+                value = *instanceField(instance, entry->fieldSlot);
+            } else if (!lookupProperty(instance, name, cache, &value, &method)) {
+                if (IS_NULL(method)) {
+                    runtimeError(vm, "Undefined property '%s'.", name->chars);
+                    return false;
+                }
 
-                return callValue(vm, value, argCount);
+                return call(vm, AS_CLOSURE(method), argCount);
             }
 
-            return invokeFromClass(vm, instance->klass, name, argCount);
+            vm->stackTop[-argCount - 1] = value;
+            return callValue(vm, value, argCount);
         }
 
+        case OBJ_LAZY_STRING:
+            flattenStrings(vm, vm->stackTop - argCount - 1, 1);
+            // Fall through.
+
         case OBJ_STRING: {
             return declareString(vm, name->chars, argCount + 1);
         }
 
         case OBJ_LIST: {
-            return declareList(vm, name->chars, argCount + 1);
+            Value method;
+
+            if (!tableGet(&vm->listClass->methods, name, &method)) {
+                runtimeError(vm, "List has no method %s()", name->chars);
+                return false;
+            }
+
+            return callMethod(vm, method, argCount);
+        }
+
+        case OBJ_FLOAT_ARRAY: {
+            Value method;
+
+            if (!tableGet(&vm->floatArrayClass->methods, name, &method)) {
+                runtimeError(vm, "Float64Array has no method %s()", name->chars);
+                return false;
+            }
+
+            return callMethod(vm, method, argCount);
+        }
+
+        case OBJ_MAP: {
+            Value method;
+
+            if (!tableGet(&vm->mapClass->methods, name, &method)) {
+                runtimeError(vm, "Map has no method %s()", name->chars);
+                return false;
+            }
+
+            return callMethod(vm, method, argCount);
         }
 
          default: {
@@ -286,6 +608,7 @@ static void closeUpvalues(GhostVM *vm, Value* last) {
         ObjUpvalue* upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeBarrier(vm, (Obj*)upvalue, upvalue->closed);
         vm->openUpvalues = upvalue->next;
     }
 }
@@ -294,6 +617,9 @@ static void defineMethod(GhostVM *vm, ObjString* name) {
     Value method = peek(vm, 0);
     ObjClass* klass = AS_CLASS(peek(vm, 1));
     tableSet(vm, &klass->methods, name, method);
+    writeBarrier(vm, (Obj*)klass, OBJ_VAL(name));
+    writeBarrier(vm, (Obj*)klass, method);
+    klass->version = ++vm->classVersion;
     pop(vm);
 }
 
@@ -302,451 +628,1057 @@ bool isFalsey(Value value) {
            (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// Concatenations at least this long produce a lazy string instead of
+// interning their result.
+#define LAZY_STRING_MIN_LENGTH 128
+
+static bool isString(Value value) {
+    return IS_STRING(value) || IS_LAZY_STRING(value);
+}
+
+static int stringLength(Value value) {
+    if (IS_LAZY_STRING(value)) return AS_LAZY_STRING(value)->length;
+    return AS_STRING(value)->length;
+}
+
+static const char* stringChars(Value value) {
+    if (IS_LAZY_STRING(value)) return AS_LAZY_STRING(value)->buffer->chars;
+    return AS_STRING(value)->chars;
+}
+
 static void concatenate(GhostVM *vm) {
-    ObjString* b = AS_STRING(peek(vm, 0));
-    ObjString* a = AS_STRING(peek(vm, 1));
+    Value b = peek(vm, 0);
+    Value a = peek(vm, 1);
+    int aLength = stringLength(a);
+    int bLength = stringLength(b);
+    int length = aLength + bLength;
+
+    // Both operands stay on the stack while the result is allocated.
+    if (length < LAZY_STRING_MIN_LENGTH) {
+        ObjString* result = newString(vm, length);
+        memcpy(result->chars, stringChars(a), aLength);
+        memcpy(result->chars + aLength, stringChars(b), bLength);
+
+        result = internString(vm, result);
+        pop(vm);
+        pop(vm);
+        push(vm, OBJ_VAL(result));
+        return;
+    }
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(vm, char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    ObjStringBuffer* buffer;
 
-    ObjString* result = takeString(vm, chars, length);
-    pop(vm);
-    pop(vm);
+    if (IS_LAZY_STRING(a) && AS_LAZY_STRING(a)->buffer->count == aLength) {
+        // Nothing has been appended after [a] yet, so [b] can go straight
+        // into its buffer.
+        buffer = AS_LAZY_STRING(a)->buffer;
+        push(vm, OBJ_VAL(buffer));
+    } else {
+        buffer = newStringBuffer(vm);
+        push(vm, OBJ_VAL(buffer));
+        reserveStringBuffer(vm, buffer, length);
+        memcpy(buffer->chars, stringChars(a), aLength);
+        buffer->count = aLength;
+    }
+
+    reserveStringBuffer(vm, buffer, length);
+
+    // [b] may share the buffer, so its characters are only looked up once
+    // reserving is done moving them.
+    memcpy(buffer->chars + aLength, stringChars(b), bLength);
+    buffer->count = length;
+
+    ObjLazyString* result = newLazyString(vm, buffer, length);
+    vm->stackTop -= 3;
     push(vm, OBJ_VAL(result));
 }
 
+// Runs the function in the topmost call frame until it returns. Natives that
+// call back into Ghost code enter run() again through callFromNative().
 static InterpretResult run(GhostVM *vm) {
-    CallFrame* frame = &vm->frames[vm->frameCount - 1];
-
-    #define READ_BYTE() (*frame->ip++)
+    CallFrame* frame;
+    int baseFrame = vm->frameCount - 1;
+
+    // The instruction pointer, the top of the value stack and the constant
+    // table of the running function are the hottest state in the VM, so they
+    // are kept in locals where the compiler can hold them in registers. They
+    // are only written back to the CallFrame and GhostVM when something else
+    // needs to see them: calls, returns, allocations (which may trigger the
+    // garbage collector) and runtime errors.
+    uint8_t* ip;
+    Value* stackTop;
+    Value* constants;
+
+    // The constant index of instructions that also have a wide (_LONG) form.
+    // Each wide handler reads its three byte operand into this and jumps into
+    // the body of the narrow one, just past where that reads its single byte.
+    int operand;
+
+    #define PUSH(value)    (*stackTop++ = (value))
+    #define POP()          (*(--stackTop))
+    #define PEEK(distance) (stackTop[-1 - (distance)])
+    #define DROP()         (stackTop--)
+
+    #define READ_BYTE() (*ip++)
     #define READ_SHORT() \
-        (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-    #define READ_CONSTANT() \
-        (frame->closure->function->chunk.constants.values[READ_BYTE()])
+        (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+    #define READ_LONG() \
+        (ip += 3, (int)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+    #define READ_CONSTANT() (constants[READ_BYTE()])
+    #define READ_CACHE() (&frame->closure->function->chunk.caches[READ_SHORT()])
+
+    // Writes the cached state back so the rest of the VM sees it.
+    #define STORE_FRAME() \
+        do { \
+            frame->ip = ip; \
+            vm->stackTop = stackTop; \
+        } while (false)
 
-    #define READ_STRING() AS_STRING(READ_CONSTANT())
+    // Reloads the cached state after the current frame may have changed.
+    #define LOAD_FRAME() \
+        do { \
+            frame = &vm->frames[vm->frameCount - 1]; \
+            ip = frame->ip; \
+            stackTop = vm->stackTop; \
+            constants = frame->closure->function->chunk.constants.values; \
+        } while (false)
+
+    // Carries on in machine code from [ip] if the current function has been
+    // compiled, or has just become hot enough to be. Called wherever control
+    // moves between or back within functions: calls, returns and loops.
+    #if JIT_COMPILER
+        #define ENTER_JIT() \
+            do { \
+                STORE_FRAME(); \
+                uint8_t* jitCode = jitEntry(vm, frame->closure->function, ip); \
+                \
+                if (jitCode != NULL) { \
+                    jitRun(vm, frame, jitCode); \
+                    LOAD_FRAME(); \
+                } \
+            } while (false)
+    #else
+        #define ENTER_JIT() do { } while (false)
+    #endif
+
+    #define RUNTIME_ERROR(...) \
+        do { \
+            STORE_FRAME(); \
+            runtimeError(vm, __VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
 
     #define BINARY_OP(valueType, op) \
         do { \
-            if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-                runtimeError(vm, "Operands must be numbers."); \
-                return INTERPRET_RUNTIME_ERROR; \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
             } \
             \
-            double b = AS_NUMBER(pop(vm)); \
-            double a = AS_NUMBER(pop(vm)); \
-            push(vm, valueType(a op b)); \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(valueType(a op b)); \
         } while (false)
 
-    for (;;) {
-        #if DEBUG_TRACE_EXECUTION
-            printf("          ");
+    // The comparisons fused with a following OP_NOT by the optimizer negate
+    // the result of the comparison they replace rather than using the
+    // opposite operator, which would give a different answer for NaN.
+    #define NEGATED_BINARY_OP(op) \
+        do { \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(BOOL_VAL(!(a op b))); \
+        } while (false)
 
-            for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
-                printf("[ ");
-                printValue(*slot);
-                printf(" ]");
-            }
+    // Rewrites the instruction just read, which must be one byte long, into
+    // its quickened form [op].
+    #define QUICKEN(op) (ip[-1] = OP_##op)
 
-            printf("\n");
+    // The body of a quickened instruction, which pushes [result] computed
+    // from the two numbers [a] and [b]. Any other operands turn it back into
+    // the [generic] instruction, which is then executed in its place and
+    // deals with them or reports the error.
+    #define NUMBER_OP(generic, result) \
+        do { \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                ip[-1] = OP_##generic; \
+                ip--; \
+                DISPATCH(); \
+            } \
+            \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(result); \
+        } while (false)
 
-            disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
-        #endif
+    // Hands [value] back to the caller of the current frame, or out of run()
+    // once the frame that run() started with returns.
+    #define RETURN_FROM_FRAME(value) \
+        do { \
+            Value returned = (value); \
+            closeUpvalues(vm, frame->slots); \
+            \
+            vm->frameCount--; \
+            \
+            if (vm->frameCount == baseFrame) { \
+                /* A native called this function, and gets its result on */ \
+                /* the stack. The script itself has no caller to hand it to. */ \
+                stackTop = frame->slots; \
+                if (baseFrame > 0) PUSH(returned); \
+                \
+                vm->stackTop = stackTop; \
+                return INTERPRET_OK; \
+            } \
+            \
+            stackTop = frame->slots; \
+            PUSH(returned); \
+            \
+            vm->stackTop = stackTop; \
+            LOAD_FRAME(); \
+            ENTER_JIT(); \
+            DISPATCH(); \
+        } while (false)
 
-        uint8_t instruction;
+    #if DEBUG_TRACE_EXECUTION
+        #define TRACE_INSTRUCTION() \
+            do { \
+                printf("          "); \
+                for (Value* slot = vm->stack; slot < stackTop; slot++) { \
+                    printf("[ "); \
+                    printValue(*slot); \
+                    printf(" ]"); \
+                } \
+                printf("\n"); \
+                disassembleInstruction(&frame->closure->function->chunk, \
+                    (int)(ip - frame->closure->function->chunk.code)); \
+            } while (false)
+    #else
+        #define TRACE_INSTRUCTION() do { } while (false)
+    #endif
+
+    #if COMPUTED_GOTO
+        // One label per opcode, in the same order as the OpCode enum, so the
+        // byte just read can index straight into it.
+        static void* dispatchTable[] = {
+            #define OPCODE(name) &&code_##name,
+            #include "opcodes.h"
+            #undef OPCODE
+        };
+
+        #define INTERPRET_LOOP  DISPATCH();
+        #define CASE_CODE(name) code_##name
+
+        #define DISPATCH() \
+            do { \
+                TRACE_INSTRUCTION(); \
+                goto *dispatchTable[READ_BYTE()]; \
+            } while (false)
+    #else
+        #define INTERPRET_LOOP \
+            loop: \
+                TRACE_INSTRUCTION(); \
+                switch (READ_BYTE())
+
+        #define CASE_CODE(name) case OP_##name
+        #define DISPATCH()      goto loop
+    #endif
+
+    LOAD_FRAME();
+
+    INTERPRET_LOOP
+    {
+        CASE_CODE(CONSTANT): {
+            PUSH(READ_CONSTANT());
+            DISPATCH();
+        }
 
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(vm, constant);
-                break;
-            }
+        CASE_CODE(CONSTANT_LONG): {
+            PUSH(constants[READ_LONG()]);
+            DISPATCH();
+        }
 
-            case OP_NULL: push(vm, NULL_VAL); break;
-            case OP_TRUE: push(vm, BOOL_VAL(true)); break;
-            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
-            case OP_POP: pop(vm); break;
+        CASE_CODE(NULL): PUSH(NULL_VAL); DISPATCH();
+        CASE_CODE(TRUE): PUSH(BOOL_VAL(true)); DISPATCH();
+        CASE_CODE(FALSE): PUSH(BOOL_VAL(false)); DISPATCH();
+        CASE_CODE(POP): DROP(); DISPATCH();
 
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                push(vm, frame->slots[slot]);
-                break;
+        CASE_CODE(GET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            PUSH(frame->slots[slot]);
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+
+        CASE_CODE(GET_LOCAL_LONG): {
+            uint16_t slot = READ_SHORT();
+            PUSH(frame->slots[slot]);
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_LOCAL_LONG): {
+            uint16_t slot = READ_SHORT();
+            frame->slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+
+        CASE_CODE(GET_LOCAL_GET_LOCAL): {
+            uint8_t first = READ_BYTE();
+            uint8_t second = READ_BYTE();
+            stackTop[0] = frame->slots[first];
+            stackTop[1] = frame->slots[second];
+            stackTop += 2;
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_LOCAL_POP): {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = POP();
+            DISPATCH();
+        }
+
+        CASE_CODE(ADD_LOCAL_CONST): {
+            Value local = frame->slots[READ_BYTE()];
+            double constant = AS_NUMBER(READ_CONSTANT());
+
+            if (!IS_NUMBER(local)) {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
             }
 
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(vm, 0);
-                break;
+            PUSH(NUMBER_VAL(AS_NUMBER(local) + constant));
+            DISPATCH();
+        }
+
+        CASE_CODE(SUBTRACT_LOCAL_CONST): {
+            Value local = frame->slots[READ_BYTE()];
+            double constant = AS_NUMBER(READ_CONSTANT());
+
+            if (!IS_NUMBER(local)) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
 
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
+            PUSH(NUMBER_VAL(AS_NUMBER(local) - constant));
+            DISPATCH();
+        }
 
-                if (!tableGet(&vm->globals, name, &value)) {
-                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+        CASE_CODE(LESS_LOCAL_CONST_JUMP): {
+            Value local = frame->slots[READ_BYTE()];
+            double constant = AS_NUMBER(READ_CONSTANT());
+            uint16_t offset = READ_SHORT();
 
-                push(vm, value);
-                break;
+            if (!IS_NUMBER(local)) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
 
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                tableSet(vm, &vm->globals, name, peek(vm, 0));
+            if (!(AS_NUMBER(local) < constant)) ip += offset;
+            DISPATCH();
+        }
 
-                pop(vm);
-                break;
+        CASE_CODE(GREATER_LOCAL_CONST_JUMP): {
+            Value local = frame->slots[READ_BYTE()];
+            double constant = AS_NUMBER(READ_CONSTANT());
+            uint16_t offset = READ_SHORT();
+
+            if (!IS_NUMBER(local)) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
 
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
+            if (!(AS_NUMBER(local) > constant)) ip += offset;
+            DISPATCH();
+        }
 
-                if (tableSet(vm, &vm->globals, name, peek(vm, 0))) {
-                    tableDelete(&vm->globals, name);
-                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+        CASE_CODE(GET_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            Value value = vm->globalValues.values[slot];
 
-                break;
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", globalName(vm, slot)->chars);
             }
 
-            case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                push(vm, *frame->closure->upvalues[slot]->location);
-                break;
+            PUSH(value);
+            DISPATCH();
+        }
+
+        CASE_CODE(DEFINE_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            vm->globalValues.values[slot] = POP();
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+
+            if (IS_UNDEFINED(vm->globalValues.values[slot])) {
+                RUNTIME_ERROR("Undefined variable '%s'.", globalName(vm, slot)->chars);
             }
 
-            case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(vm, 0);
-                break;
+            vm->globalValues.values[slot] = PEEK(0);
+            DISPATCH();
+        }
+
+        CASE_CODE(GET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            PUSH(*frame->closure->upvalues[slot]->location);
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+            *upvalue->location = PEEK(0);
+            writeBarrier(vm, (Obj*)upvalue, PEEK(0));
+            DISPATCH();
+        }
+
+        CASE_CODE(GET_PROPERTY_LONG): operand = READ_LONG(); goto getPropertyOp;
+
+        CASE_CODE(GET_PROPERTY):
+            operand = READ_BYTE();
+        getPropertyOp: {
+            if (!IS_INSTANCE(PEEK(0))) {
+                RUNTIME_ERROR("Only instance have properties.");
             }
 
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(vm, 0))) {
-                    runtimeError(vm, "Only instance have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            ObjInstance* instance = AS_INSTANCE(PEEK(0));
+            ObjString* name = AS_STRING(constants[operand]);
+            InlineCache* cache = READ_CACHE();
+            InlineCacheEntry* entry = findCacheEntry(cache, instance);
+
+            Value method;
 
-                ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
-                ObjString* name = READ_STRING();
+            if (entry != NULL) {
+                if (entry->fieldSlot >= 0) {
+                    stackTop[-1] = *instanceField(instance, entry->fieldSlot); // Replaces the instance
+                    DISPATCH();
+                }
 
+                method = entry->method;
+            } else {
                 Value value;
 
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop(vm); // Instance
-                    push(vm, value);
-                    break;
+                if (lookupProperty(instance, name, cache, &value, &method)) {
+                    stackTop[-1] = value; // Replaces the instance
+                    DISPATCH();
                 }
 
-                if (!bindMethod(vm, instance->klass, name)) {
-                    return INTERPRET_RUNTIME_ERROR;
+                if (IS_NULL(method)) {
+                    RUNTIME_ERROR("Undefined property '%s' on '%s'.", name->chars, instance->klass->name->chars);
                 }
-
-                break;
             }
 
-            case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(vm, 1))) {
-                    runtimeError(vm, "Only instance have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            STORE_FRAME();
+            ObjBoundMethod* bound = newBoundMethod(vm, PEEK(0), AS_CLOSURE(method));
+            stackTop[-1] = OBJ_VAL(bound);
+            DISPATCH();
+        }
 
-                ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
-                tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
+        CASE_CODE(SET_PROPERTY_LONG): operand = READ_LONG(); goto setPropertyOp;
 
-                Value value = pop(vm);
-                pop(vm);
-                push(vm, value);
-                break;
+        CASE_CODE(SET_PROPERTY):
+            operand = READ_BYTE();
+        setPropertyOp: {
+            if (!IS_INSTANCE(PEEK(1))) {
+                RUNTIME_ERROR("Only instance have properties.");
             }
 
-            case OP_GET_SUPER: {
-                ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop(vm));
+            ObjInstance* instance = AS_INSTANCE(PEEK(1));
+            ObjString* name = AS_STRING(constants[operand]);
+            InlineCache* cache = READ_CACHE();
 
-                if (!bindMethod(vm, superclass, name)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            InlineCacheEntry* entry = findCacheEntry(cache, instance);
 
-                break;
-            }
+            if (entry != NULL && entry->transition == NULL) {
+                *instanceField(instance, entry->fieldSlot) = PEEK(0);
+                writeBarrier(vm, (Obj*)instance, PEEK(0));
+            } else if (entry != NULL) {
+                STORE_FRAME();
+                instanceAddField(vm, instance, entry->transition, PEEK(0));
+            } else {
+                Shape* shape = instance->shape;
 
-            case OP_EQUAL: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                push(vm, BOOL_VAL(valuesEqual(a, b)));
-                break;
-            }
+                STORE_FRAME();
+                instanceSetField(vm, instance, name, PEEK(0));
 
-            case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
-            case OP_ADD: {
-                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-                    concatenate(vm);
-                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-                    double b = AS_NUMBER(pop(vm));
-                    double a = AS_NUMBER(pop(vm));
-                    push(vm, NUMBER_VAL(a + b));
-                } else {
-                    runtimeError(vm, "Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                if (instance->shape != NULL) {
+                    int slot = shapeFindSlot(instance->shape, name);
+                    Shape* transition = instance->shape == shape ? NULL : instance->shape;
+                    updateCache(cache, instance->klass, shape, slot, NULL_VAL, transition);
                 }
-                break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
 
-            case OP_MODULO: {
-                if (! IS_NUMBER(peek(vm, 0)) && ! IS_NUMBER(peek(vm, 1))) {
-                    runtimeError(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            Value value = POP();
+            DROP();
+            PUSH(value);
+            DISPATCH();
+        }
 
-                double b = AS_NUMBER(pop(vm));
-                double a = AS_NUMBER(pop(vm));
-                push(vm, NUMBER_VAL(fmod(a, b)));
-                break;
-            }
+        CASE_CODE(GET_SUPER_LONG): operand = READ_LONG(); goto getSuperOp;
 
-            case OP_NOT: {
-                push(vm, BOOL_VAL(isFalsey(pop(vm))));
-                break;
+        CASE_CODE(GET_SUPER):
+            operand = READ_BYTE();
+        getSuperOp: {
+            ObjString* name = AS_STRING(constants[operand]);
+            ObjClass* superclass = AS_CLASS(POP());
+
+            STORE_FRAME();
+
+            if (!bindMethod(vm, superclass, name)) {
+                return INTERPRET_RUNTIME_ERROR;
             }
 
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    runtimeError(vm, "Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            stackTop = vm->stackTop;
+            DISPATCH();
+        }
 
-                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+        CASE_CODE(EQUAL): {
+            bool equal = valuesEqual(PEEK(0), PEEK(1));
 
-                break;
+            // Strings are compared by identity, which lazy strings only
+            // have once they are flattened.
+            if (!equal && (IS_LAZY_STRING(PEEK(0)) || IS_LAZY_STRING(PEEK(1)))) {
+                STORE_FRAME();
+                flattenStrings(vm, stackTop - 2, 2);
+                equal = valuesEqual(PEEK(0), PEEK(1));
             }
 
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+            stackTop -= 2;
+            PUSH(BOOL_VAL(equal));
+            DISPATCH();
+        }
+
+        CASE_CODE(GREATER): BINARY_OP(BOOL_VAL, >); QUICKEN(GREATER_NUM); DISPATCH();
+        CASE_CODE(LESS): BINARY_OP(BOOL_VAL, <); QUICKEN(LESS_NUM); DISPATCH();
+
+        CASE_CODE(NOT_EQUAL): {
+            bool equal = valuesEqual(PEEK(0), PEEK(1));
+
+            if (!equal && (IS_LAZY_STRING(PEEK(0)) || IS_LAZY_STRING(PEEK(1)))) {
+                STORE_FRAME();
+                flattenStrings(vm, stackTop - 2, 2);
+                equal = valuesEqual(PEEK(0), PEEK(1));
             }
 
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(vm, 0))) frame->ip += offset;
-                break;
+            stackTop -= 2;
+            PUSH(BOOL_VAL(!equal));
+            DISPATCH();
+        }
+
+        CASE_CODE(GREATER_EQUAL): NEGATED_BINARY_OP(<); QUICKEN(GREATER_EQUAL_NUM); DISPATCH();
+        CASE_CODE(LESS_EQUAL): NEGATED_BINARY_OP(>); QUICKEN(LESS_EQUAL_NUM); DISPATCH();
+
+        CASE_CODE(ADD): {
+            if (isString(PEEK(0)) && isString(PEEK(1))) {
+                STORE_FRAME();
+                concatenate(vm);
+                stackTop = vm->stackTop;
+            } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(POP());
+                PUSH(NUMBER_VAL(a + b));
+                QUICKEN(ADD_NUM);
+            } else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+        CASE_CODE(SUBTRACT): BINARY_OP(NUMBER_VAL, -); QUICKEN(SUBTRACT_NUM); DISPATCH();
+        CASE_CODE(MULTIPLY): BINARY_OP(NUMBER_VAL, *); QUICKEN(MULTIPLY_NUM); DISPATCH();
+        CASE_CODE(DIVIDE): BINARY_OP(NUMBER_VAL, /); QUICKEN(DIVIDE_NUM); DISPATCH();
+
+        CASE_CODE(ADD_NUM): NUMBER_OP(ADD, NUMBER_VAL(a + b)); DISPATCH();
+        CASE_CODE(SUBTRACT_NUM): NUMBER_OP(SUBTRACT, NUMBER_VAL(a - b)); DISPATCH();
+        CASE_CODE(MULTIPLY_NUM): NUMBER_OP(MULTIPLY, NUMBER_VAL(a * b)); DISPATCH();
+        CASE_CODE(DIVIDE_NUM): NUMBER_OP(DIVIDE, NUMBER_VAL(a / b)); DISPATCH();
+        CASE_CODE(GREATER_NUM): NUMBER_OP(GREATER, BOOL_VAL(a > b)); DISPATCH();
+        CASE_CODE(LESS_NUM): NUMBER_OP(LESS, BOOL_VAL(a < b)); DISPATCH();
+        CASE_CODE(GREATER_EQUAL_NUM): NUMBER_OP(GREATER_EQUAL, BOOL_VAL(!(a < b))); DISPATCH();
+        CASE_CODE(LESS_EQUAL_NUM): NUMBER_OP(LESS_EQUAL, BOOL_VAL(!(a > b))); DISPATCH();
+
+        CASE_CODE(MODULO): {
+            if (! IS_NUMBER(PEEK(0)) && ! IS_NUMBER(PEEK(1))) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
 
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+            double b = AS_NUMBER(POP());
+            double a = AS_NUMBER(POP());
+            PUSH(NUMBER_VAL(fmod(a, b)));
+            DISPATCH();
+        }
+
+        CASE_CODE(NOT): {
+            stackTop[-1] = BOOL_VAL(isFalsey(PEEK(0)));
+            DISPATCH();
+        }
+
+        CASE_CODE(NEGATE): {
+            if (!IS_NUMBER(PEEK(0))) {
+                RUNTIME_ERROR("Operand must be a number.");
             }
 
-            case OP_CALL: {
-                int argCount = READ_BYTE();
+            stackTop[-1] = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
 
-                if (!callValue(vm, peek(vm, argCount), argCount)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            DISPATCH();
+        }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+        CASE_CODE(JUMP): {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+
+        CASE_CODE(JUMP_IF_FALSE): {
+            uint16_t offset = READ_SHORT();
+            if (isFalsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+
+        CASE_CODE(JUMP_IF_TRUE): {
+            uint16_t offset = READ_SHORT();
+            if (!isFalsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+
+        CASE_CODE(LOOP): {
+            uint16_t offset = READ_SHORT();
+            ip -= offset;
+            ENTER_JIT();
+            DISPATCH();
+        }
+
+        CASE_CODE(CALL): {
+            int argCount = READ_BYTE();
+            STORE_FRAME();
+
+            if (!callValue(vm, PEEK(argCount), argCount)) {
+                return INTERPRET_RUNTIME_ERROR;
             }
 
-            case OP_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
+        }
 
-                if (!invoke(vm, method, argCount)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+        CASE_CODE(TAIL_CALL): {
+            int argCount = READ_BYTE();
+            Value callee = PEEK(argCount);
+            ObjClosure* closure = NULL;
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+            if (IS_CLOSURE(callee)) {
+                closure = AS_CLOSURE(callee);
+            } else if (IS_BOUND_METHOD(callee)) {
+                ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+                stackTop[-argCount - 1] = bound->receiver;
+                closure = bound->method;
             }
 
-            case OP_SUPER_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
-                ObjClass* superclass = AS_CLASS(pop(vm));
+            // Natives and classes are called as usual, and the OP_RETURN
+            // that follows hands back their result.
+            if (closure == NULL) {
+                STORE_FRAME();
 
-                if (!invokeFromClass(vm, superclass, method, argCount)) {
+                if (!callValue(vm, callee, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
             }
 
-            case OP_CLOSURE: {
-                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure* closure = newClosure(vm, function);
-                push(vm, OBJ_VAL(closure));
+            if (argCount != closure->function->arity) {
+                RUNTIME_ERROR("Expected %d arguments but got %d.", closure->function->arity, argCount);
+            }
 
-                for (int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
+            // The callee replaces this function in its frame. Upvalues that
+            // still point at this function's locals are closed first, since
+            // the callee and its arguments slide down over them.
+            closeUpvalues(vm, frame->slots);
+            memmove(frame->slots, stackTop - argCount - 1, (argCount + 1) * sizeof(Value));
 
-                    if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(vm, frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
-                }
-                break;
-            }
+            frame->closure = closure;
+            frame->ip = closure->function->chunk.code;
+            vm->stackTop = frame->slots + argCount + 1;
+            ensureStack(vm, closure->function->slotCount);
 
-            case OP_CLOSE_UPVALUE:
-                closeUpvalues(vm, vm->stackTop - 1);
-                pop(vm);
-                break;
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
+        }
 
-            case OP_RETURN: {
-                Value result = pop(vm);
+        CASE_CODE(INVOKE_LONG): operand = READ_LONG(); goto invokeOp;
 
-                closeUpvalues(vm, frame->slots);
+        CASE_CODE(INVOKE):
+            operand = READ_BYTE();
+        invokeOp: {
+            ObjString* method = AS_STRING(constants[operand]);
+            int argCount = READ_BYTE();
+            InlineCache* cache = READ_CACHE();
+            STORE_FRAME();
 
-                vm->frameCount--;
+            if (!invoke(vm, method, argCount, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
 
-                if (vm->frameCount == 0) {
-                    pop(vm);
-                    return INTERPRET_OK;
-                }
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
+        }
 
-                vm->stackTop = frame->slots;
-                push(vm, result);
+        CASE_CODE(SUPER_INVOKE_LONG): operand = READ_LONG(); goto superInvokeOp;
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+        CASE_CODE(SUPER_INVOKE):
+            operand = READ_BYTE();
+        superInvokeOp: {
+            ObjString* method = AS_STRING(constants[operand]);
+            int argCount = READ_BYTE();
+            ObjClass* superclass = AS_CLASS(POP());
+            STORE_FRAME();
+
+            if (!invokeFromClass(vm, superclass, method, argCount)) {
+                return INTERPRET_RUNTIME_ERROR;
             }
 
-            case OP_CLASS:
-                push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
-                break;
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
+        }
 
-            case OP_INHERIT: {
-                Value superclass = peek(vm, 1);
+        CASE_CODE(CLOSURE_LONG): operand = READ_LONG(); goto closureOp;
 
-                if (!IS_CLASS(superclass)) {
-                    runtimeError(vm, "Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
+        CASE_CODE(CLOSURE):
+            operand = READ_BYTE();
+        closureOp: {
+            ObjFunction* function = AS_FUNCTION(constants[operand]);
+            STORE_FRAME();
+            ObjClosure* closure = newClosure(vm, function);
+            PUSH(OBJ_VAL(closure));
+
+            // Capturing an upvalue allocates, so keep the closure rooted.
+            vm->stackTop = stackTop;
+
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                uint8_t isLocal = READ_BYTE();
+                uint16_t index = READ_SHORT();
+
+                if (isLocal) {
+                    closure->upvalues[i] = captureUpvalue(vm, frame->slots + index);
+                } else {
+                    closure->upvalues[i] = frame->closure->upvalues[index];
                 }
 
-                ObjClass* subclass = AS_CLASS(peek(vm, 0));
-                tableAddAll(vm, &AS_CLASS(superclass)->methods, &subclass->methods);
-                pop(vm);  // subclass
-                break;
+                // A collection while capturing may have already promoted
+                // the closure.
+                writeBarrier(vm, (Obj*)closure, OBJ_VAL(closure->upvalues[i]));
             }
+            DISPATCH();
+        }
 
-            case OP_METHOD:
-                defineMethod(vm, READ_STRING());
-                break;
+        CASE_CODE(CLOSE_UPVALUE):
+            closeUpvalues(vm, stackTop - 1);
+            DROP();
+            DISPATCH();
 
-            case OP_INCLUDE: {
-                ObjString *fileName = AS_STRING(pop(vm));
-                char *source = readFile(fileName->chars);
+        CASE_CODE(RETURN): {
+            Value result = POP();
+            RETURN_FROM_FRAME(result);
+        }
 
-                ObjFunction *function = ghostCompile(vm, source);
-                if (function == NULL) return INTERPRET_COMPILE_ERROR;
+        CASE_CODE(RETURN_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            RETURN_FROM_FRAME(frame->slots[slot]);
+        }
 
-                push(vm, OBJ_VAL(function));
-                ObjClosure *closure = newClosure(vm, function);
-                pop(vm);
+        CASE_CODE(CLASS_LONG): operand = READ_LONG(); goto classOp;
 
-                frame = &vm->frames[vm->frameCount++];
-                frame->ip = closure->function->chunk.code;
-                frame->closure = closure;
-                frame->slots = vm->stackTop - 1;
+        CASE_CODE(CLASS):
+            operand = READ_BYTE();
+        classOp: {
+            ObjString* name = AS_STRING(constants[operand]);
+            STORE_FRAME();
+            PUSH(OBJ_VAL(newClass(vm, name)));
+            DISPATCH();
+        }
 
-                break;
+        CASE_CODE(INHERIT): {
+            Value superclass = PEEK(1);
+
+            if (!IS_CLASS(superclass)) {
+                RUNTIME_ERROR("Superclass must be a class.");
             }
 
-            case OP_NEW_LIST: {
-                ObjList* list = newList(vm);
-                push(vm, OBJ_VAL(list));
-                break;
+            ObjClass* subclass = AS_CLASS(PEEK(0));
+            STORE_FRAME();
+            tableAddAll(vm, &AS_CLASS(superclass)->methods, &subclass->methods);
+            subclass->version = ++vm->classVersion;
+
+            // The superclass can only hold young methods if it is young, or
+            // has been remembered, itself.
+            writeBarrier(vm, (Obj*)subclass, superclass);
+            DROP();  // subclass
+            DISPATCH();
+        }
+
+        CASE_CODE(METHOD_LONG): operand = READ_LONG(); goto methodOp;
+
+        CASE_CODE(METHOD):
+            operand = READ_BYTE();
+        methodOp: {
+            ObjString* name = AS_STRING(constants[operand]);
+            STORE_FRAME();
+            defineMethod(vm, name);
+            stackTop = vm->stackTop;
+            DISPATCH();
+        }
+
+        CASE_CODE(INCLUDE): {
+            STORE_FRAME();
+            ObjModule *module = loadModule(vm, AS_STRING(PEEK(0)));
+
+            if (module == NULL) return INTERPRET_COMPILE_ERROR;
+            if (!runModule(vm, module)) return INTERPRET_RUNTIME_ERROR;
+
+            LOAD_FRAME();
+            DISPATCH();
+        }
+
+        CASE_CODE(IMPORT): {
+            STORE_FRAME();
+            ObjModule *module = loadModule(vm, AS_STRING(PEEK(0)));
+
+            if (module == NULL) return INTERPRET_COMPILE_ERROR;
+
+            if (module->executed) {
+                // Leave the null the body would have returned.
+                PEEK(0) = NULL_VAL;
+                DISPATCH();
             }
 
-            case OP_ADD_LIST: {
-                Value addValue = pop(vm);
-                Value listValue = pop(vm);
+            if (!runModule(vm, module)) return INTERPRET_RUNTIME_ERROR;
 
-                ObjList* list = AS_LIST(listValue);
-                writeValueArray(vm, &list->values, addValue);
+            LOAD_FRAME();
+            DISPATCH();
+        }
 
-                push(vm, OBJ_VAL(list));
-                break;
+        CASE_CODE(NEW_LIST): {
+            STORE_FRAME();
+            ObjList* list = newList(vm);
+            PUSH(OBJ_VAL(list));
+            DISPATCH();
+        }
+
+        CASE_CODE(ADD_LIST): {
+            // Leave both operands on the stack while the list grows so the
+            // garbage collector can still see them.
+            Value addValue = PEEK(0);
+            ObjList* list = AS_LIST(PEEK(1));
+
+            STORE_FRAME();
+            writeValueArray(vm, &list->values, addValue);
+            writeBarrier(vm, (Obj*)list, addValue);
+
+            DROP();
+            DISPATCH();
+        }
+
+        CASE_CODE(NEW_MAP): {
+            STORE_FRAME();
+            ObjMap* map = newMap(vm);
+            PUSH(OBJ_VAL(map));
+            DISPATCH();
+        }
+
+        CASE_CODE(ADD_MAP): {
+            // As with lists, the map, key and value stay on the stack until
+            // the entry is stored.
+            STORE_FRAME();
+            flattenStrings(vm, stackTop - 2, 1);
+            mapSet(vm, AS_MAP(PEEK(2)), PEEK(1), PEEK(0));
+
+            DROP();
+            DROP();
+            DISPATCH();
+        }
+
+        CASE_CODE(SUBSCRIPT): {
+            Value indexValue = PEEK(0);
+            Value listValue = PEEK(1);
+
+            if (IS_MAP(listValue)) {
+                if (IS_LAZY_STRING(indexValue)) {
+                    STORE_FRAME();
+                    flattenStrings(vm, stackTop - 1, 1);
+                    indexValue = PEEK(0);
+                }
+
+                // Missing keys read as null.
+                Value element;
+                if (!mapGet(AS_MAP(listValue), indexValue, &element)) {
+                    element = NULL_VAL;
+                }
+
+                DROP();
+                DROP();
+                PUSH(element);
+                DISPATCH();
             }
 
-            case OP_SUBSCRIPT: {
-                Value indexValue = pop(vm);
-                Value listValue = pop(vm);
+            int index;
+            if (!IS_NUMBER(indexValue) || !numberToIndex(AS_NUMBER(indexValue), &index)) {
+                RUNTIME_ERROR("List index must be an integer.");
+            }
+            Value element;
 
-                if (!IS_NUMBER(indexValue)) {
-                    runtimeError(vm, "List index must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+            if (IS_FLOAT_ARRAY(listValue)) {
+                ObjFloatArray *array = AS_FLOAT_ARRAY(listValue);
+
+                if (index < 0 || index >= array->count) {
+                    RUNTIME_ERROR("Float64Array index out of bounds.");
                 }
 
+                element = NUMBER_VAL(array->values[index]);
+            } else if (IS_LIST(listValue)) {
                 ObjList *list = AS_LIST(listValue);
-                int index = AS_NUMBER(indexValue);
 
-                push(vm, list->values.values[index]);
-                break;
+                if (index < 0 || index >= list->values.count) {
+                    RUNTIME_ERROR("List index out of bounds.");
+                }
+
+                element = list->values.values[index];
+            } else {
+                RUNTIME_ERROR("Can only subscript lists and maps.");
             }
 
-            case OP_SUBSCRIPT_ASSIGN: {
-                Value assignValue = peek(vm, 0);
-                Value indexValue = peek(vm, 1);
-                Value listValue = peek(vm, 2);
+            DROP();
+            DROP();
+            PUSH(element);
+            DISPATCH();
+        }
 
-                if (!IS_OBJ(listValue)) {
-                    runtimeError(vm, "Can only subscript lists.");
-                    return INTERPRET_RUNTIME_ERROR;
+        CASE_CODE(SUBSCRIPT_ASSIGN): {
+            Value assignValue = PEEK(0);
+            Value indexValue = PEEK(1);
+            Value listValue = PEEK(2);
+
+            if (!IS_OBJ(listValue)) {
+                RUNTIME_ERROR("Can only subscript lists and maps.");
+            }
+
+            if (IS_MAP(listValue)) {
+                STORE_FRAME();
+                flattenStrings(vm, stackTop - 2, 1);
+                mapSet(vm, AS_MAP(listValue), PEEK(1), assignValue);
+
+                DROP();
+                DROP();
+                DROP();
+                PUSH(assignValue);
+                DISPATCH();
+            }
+
+            int index;
+            if (!IS_NUMBER(indexValue) || !numberToIndex(AS_NUMBER(indexValue), &index)) {
+                RUNTIME_ERROR("List index must be an integer.");
+            }
+
+            if (IS_FLOAT_ARRAY(listValue)) {
+                ObjFloatArray *array = AS_FLOAT_ARRAY(listValue);
+
+                if (!IS_NUMBER(assignValue)) {
+                    RUNTIME_ERROR("Float64Array elements must be numbers.");
                 }
 
-                if (!IS_NUMBER(indexValue)) {
-                    runtimeError(vm, "List index must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                if (index < 0 || index >= array->count) {
+                    RUNTIME_ERROR("Float64Array index out of bounds.");
                 }
 
-                ObjList *list = AS_LIST(listValue);
-                int index = AS_NUMBER(indexValue);
+                array->values[index] = AS_NUMBER(assignValue);
 
-                if (index >= 0 && index < list->values.count) {
-                    list->values.values[index] = assignValue;
-                    push(vm, NULL_VAL);
-                } else {
-                    pop(vm);
-                    pop(vm);
-                    pop(vm);
+                DROP();
+                DROP();
+                DROP();
+                PUSH(assignValue);
+                DISPATCH();
+            }
 
-                    push(vm, NULL_VAL);
+            if (!IS_LIST(listValue)) {
+                RUNTIME_ERROR("Can only subscript lists and maps.");
+            }
 
-                    runtimeError(vm, "List index out of bounds.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            ObjList *list = AS_LIST(listValue);
 
-                break;
+            if (index >= 0 && index < list->values.count) {
+                list->values.values[index] = assignValue;
+                writeBarrier(vm, (Obj*)list, assignValue);
+
+                // Like any other assignment, this evaluates to the value.
+                DROP();
+                DROP();
+                DROP();
+                PUSH(assignValue);
+            } else {
+                DROP();
+                DROP();
+                DROP();
+
+                PUSH(NULL_VAL);
+
+                RUNTIME_ERROR("List index out of bounds.");
             }
+
+            DISPATCH();
         }
     }
 
+    // Only reachable from the switch fallback with an unknown opcode.
+    return INTERPRET_RUNTIME_ERROR;
+
+    #undef PUSH
+    #undef POP
+    #undef PEEK
+    #undef DROP
     #undef READ_BYTE
     #undef READ_SHORT
+    #undef READ_LONG
     #undef READ_CONSTANT
-    #undef READ_STRING
+    #undef READ_CACHE
+    #undef STORE_FRAME
+    #undef LOAD_FRAME
+    #undef ENTER_JIT
+    #undef RUNTIME_ERROR
     #undef BINARY_OP
+    #undef NEGATED_BINARY_OP
+    #undef QUICKEN
+    #undef NUMBER_OP
+    #undef RETURN_FROM_FRAME
+    #undef TRACE_INSTRUCTION
+    #undef INTERPRET_LOOP
+    #undef CASE_CODE
+    #undef DISPATCH
 }
 
-InterpretResult ghostInterpret(GhostVM *vm, const char* source) {
-    ObjFunction* function = ghostCompile(vm, source);
+// Calls the value below [argCount] arguments on top of the stack from inside a
+// native, and replaces them all with its result. Returns false after a runtime
+// error, which has already unwound the stack. The call may move the stack, so
+// the native's [args] must not be used afterwards.
+bool callFromNative(GhostVM *vm, int argCount) {
+    Value callee = vm->stackTop[-argCount - 1];
+    int frameCount = vm->frameCount;
+
+    if (!callValue(vm, callee, argCount)) return false;
+
+    // Natives, and classes without a constructor, are already done.
+    if (vm->frameCount == frameCount) return true;
+
+    return run(vm) == INTERPRET_OK;
+}
+
+static InterpretResult interpretFunction(GhostVM *vm, ObjFunction* function) {
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
     push(vm, OBJ_VAL(function));
@@ -756,4 +1688,12 @@ InterpretResult ghostInterpret(GhostVM *vm, const char* source) {
     callValue(vm, OBJ_VAL(closure), 0);
 
     return run(vm);
+}
+
+InterpretResult ghostInterpret(GhostVM *vm, const char* source) {
+    return interpretFunction(vm, ghostCompile(vm, source));
+}
+
+InterpretResult ghostInterpretFile(GhostVM *vm, const char* path) {
+    return interpretFunction(vm, compileFile(vm, path));
 }
\ No newline at end of file
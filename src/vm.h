@@ -11,13 +11,24 @@
 
 #include "chunk.h"
 #include "object.h"
+#include "pool.h"
 #include "table.h"
 #include "value.h"
 
 #include "include/ghost.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Extra value stack slots kept free above what a call frame's own code can
+// use, for the values natives and the VM itself push while it runs. Every
+// call makes sure this many, on top of the callee's slot count, are free
+// above the top of the stack, so pushing never has to check.
+#define FRAME_STACK_SLOTS (UINT8_COUNT * 2)
+
+typedef enum {
+    GC_PHASE_IDLE,
+    GC_PHASE_CLEAR,
+    GC_PHASE_MARK,
+    GC_PHASE_SWEEP
+} GCPhase;
 
 typedef struct {
     ObjClosure* closure;
@@ -26,30 +37,108 @@ typedef struct {
 } CallFrame;
 
 struct GhostVM {
-    CallFrame frames[FRAMES_MAX];
+    // Every allocation the VM makes goes through this.
+    GhostReallocateFn reallocateFn;
+
+    // The call frames and the value stack both grow as calls nest, up to
+    // [maxCallDepth] frames. Growing the stack moves it, so nothing may hold
+    // a pointer into it across a call. The frames, the open upvalues and
+    // [stackTop] are moved along with it.
+    CallFrame* frames;
     int frameCount;
+    int frameCapacity;
+    int maxCallDepth;
 
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stackTop;
-    Table globals;
+    int stackCapacity;
+
+    // Global variables are stored in [globalValues]. The compiler resolves
+    // each name to its slot through [globalSlots], so looking one up at
+    // runtime is just an array index. Slots declared but not yet defined
+    // hold UNDEFINED_VAL.
+    Table globalSlots;
+    ValueArray globalValues;
+
     Table strings;
+
+    // Every file that has been included or imported, keyed both by the path
+    // it was named by and by its canonical path. See module.c.
+    Table modules;
     ObjString* constructorString;
+
+    // Holds the native methods every list responds to.
+    ObjNativeClass* listClass;
+
+    // Holds the native methods every map responds to.
+    ObjNativeClass* mapClass;
+
+    // Holds the native methods every Float64Array responds to.
+    ObjNativeClass* floatArrayClass;
     ObjUpvalue* openUpvalues;
 
+    // The last version handed out to a class. See ObjClass.version.
+    uint64_t classVersion;
+
+    // Every shape created so far. The first one is the empty root shape.
+    Shape** shapes;
+    int shapeCount;
+    int shapeCapacity;
+
+    // Where the memory for small object structs comes from.
+    Pool pool;
+
     // Garbage collection bookkeeping
     size_t bytesAllocated;
     size_t nextGC;
 
+    // All objects that survived a full collection, or were promoted out of
+    // the nursery.
     Obj* objects;
+
+    // Objects allocated since the last collection.
+    Obj* youngObjects;
+
+    // With the generational collector, surviving objects stay marked so the
+    // nursery collection can skip them. The nursery is collected once
+    // [bytesAllocated] passes [nurseryLimit].
+    bool generational;
+    size_t nurserySize;
+    size_t nurseryLimit;
+
+    // Old objects that had a young object written into them since the last
+    // collection. The nursery collection traces them as extra roots.
+    int rememberedCount;
+    int rememberedCapacity;
+    Obj** remembered;
+
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+
+    // The state of the whole-heap collection in progress, which advances by
+    // at most [gcStepSize] objects per allocation. See collectStep().
+    GCPhase gcPhase;
+    size_t gcStepSize;
+    Obj* clearCursor;
+    Obj* sweepOld;
+    Obj* sweepYoung;
+
+    // See GhostConfiguration.cacheBytecode.
+    bool cacheBytecode;
+
+    // See GhostConfiguration.jitThreshold.
+    int jitThreshold;
 };
 
 void push(GhostVM *vm, Value value);
 Value pop(GhostVM *vm);
 
 void defineNative(GhostVM *vm, const char *name, NativeFn function);
+int declareGlobal(GhostVM *vm, ObjString *name);
+void defineGlobal(GhostVM *vm, ObjString *name, Value value);
+
+bool callFromNative(GhostVM *vm, int argCount);
 
 void runtimeError(GhostVM *vm, const char *format, ...);
 bool isFalsey(Value value);